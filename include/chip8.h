@@ -3,6 +3,8 @@
 #define CHIP8_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 
 #define maxRam 65536
 #define pcStartDefault 0x200
@@ -15,20 +17,68 @@
 #define earthSecond 1000000
 #define displayWidth 64 /* CHIP-8 X resolution */
 #define displayHeight 32 /* CHIP-8 Y resolution */
+#define hiresWidth 128 /* SUPER-CHIP/XO-CHIP hi-res X resolution */
+#define hiresHeight 64 /* SUPER-CHIP/XO-CHIP hi-res Y resolution */
 #define defaultFgColor 0x00131A00 /* CHIP-8 Foreground color */
 #define defaultBgColor 0xF9FFB3FF /* CHIP-8 Background color */
+#define defaultPlane2Color 0x8C9A3DFF /* XO-CHIP second plane color */
+#define defaultBlendColor 0x4A5A1CFF /* XO-CHIP color where both planes are lit */
 #define defaultScale 10 /* Default resolution: 640 x 320 */
 #define defaultKeys 16
 #define defaultQuirks 10
 #define defaultPitch 64
+#define defaultTimerHz 60 /* Delay and sound timers decrement at 60hz */
+#define defaultRefreshHz 60 /* One emulated frame every 16.67ms */
+#define defaultSampleRate 48000 /* Beeper output rate */
+#define ramPageSize 256 /* Granularity of dirty tracking and save state deltas */
+#define ramPages (maxRam / ramPageSize)
 
-/* Key (or button) states */
+/* Key (or button) states. A released key reads as up, except to Fx0A:
+ * it stays keyReleased until Fx0A takes it or its frame ends. */
 typedef enum {
     keyUp,
     keyDown,
     keyReleased
 } EMUKEYS;
 
+/* Host key event, applied at the instruction boundary its offset into
+ * the frame maps to - see queueKey() */
+#define keyQueueSize 64 /* Events per frame, power of two */
+typedef struct {
+    uint32_t offset; /* Microseconds into the frame */
+    uint8_t key;
+    uint8_t state; /* EMUKEYS */
+} emuKeyEvent;
+
+/* Quirk switches - index into chip8.quirks */
+typedef enum {
+    quirkWrap, /* Sprites wrap around the screen edges instead of clipping */
+    quirkShiftVy, /* 8xy6/8xyE shift Vy into Vx instead of shifting Vx in place */
+    quirkLoadStoreI, /* Fx55/Fx65 leave I just past the last register */
+    quirkJumpVx, /* BNNN jumps to NNN + Vx (x = N's top nibble) instead of NNN + V0 */
+    quirkVfReset /* 8xy1/8xy2/8xy3 clear VF */
+} EMUQUIRK;
+
+/* Quirk presets - each has an interpreter variant built for its quirks,
+ * other combinations run a generic one (see applyQuirks()) */
+typedef enum {
+    platformCustom, /* Quirks as the host set them (default) */
+    platformChip8, /* COSMAC VIP CHIP-8 */
+    platformSuperChip, /* SUPER-CHIP 1.1 */
+    platformXoChip /* XO-CHIP */
+} EMUPLATFORM;
+
+/* Packed video memory: each plane is hiresHeight rows of vramWords words,
+ * bit 63 of a row's first word is its leftmost pixel. Low-res only uses
+ * the first word of the first displayHeight rows. */
+#define vramWords (hiresWidth / 64)
+#define vramPixel(row, x) (((row)[(x) >> 6] >> (63 - ((x) & 63))) & 1)
+
+/* Resolution of the current mode */
+#define screenWidth(chip8) ((chip8)->hires ? hiresWidth : displayWidth)
+#define screenHeight(chip8) ((chip8)->hires ? hiresHeight : displayHeight)
+
+/* Planes drawn, cleared and scrolled - bit 0 is vram, bit 1 vram2 */
 typedef enum {
     bmNone,
     bm1,
@@ -36,18 +86,123 @@ typedef enum {
     bmBoth
 } EMUBM;
 
-/* CHIP-8 "emulator" object  */
+/* Instruction engines */
+typedef enum {
+    engineCached, /* Pre-decoded instruction cache (default) */
+    engineSwitch, /* Reference decode-every-time interpreter */
+    engineJit     /* x86-64 basic block recompiler, cached engine for the rest */
+} EMUENGINE;
+
+typedef struct chip8 chip8;
+typedef struct emuJit emuJit; /* Recompiler state, private to jit.c */
+typedef struct emuTrace emuTrace; /* Trace ring buffer, private to trace.c */
+typedef struct emuRewind emuRewind; /* Rewind history, private to rewind.c */
+typedef struct emuProfile emuProfile;
+typedef struct emuAudio emuAudio; /* Beeper event ring and synth, private to audio.c */
+typedef struct emuInput emuInput; /* Input log being recorded or replayed, private to input.c */
+typedef struct emuImage emuImage; /* Shared read-only RAM image, private to memory.c */
+typedef struct emuQuirkOps emuQuirkOps; /* Quirk specialised handlers, private to chip8.c */
+typedef struct emuFrames emuFrames; /* Frame triple buffer, private to video.c */
+typedef struct emuPack emuPack; /* Memory-mapped ROM pack, private to pack.c */
+typedef struct emuCapture emuCapture; /* Video capture queue and encoder thread, private to capture.c */
+
+/* One retired instruction, as stored in the trace ring and dump files */
+typedef struct {
+    uint32_t cycle; /* Low 32 bits of instrCount after the instruction */
+    uint16_t PC; /* Address the instruction was fetched from */
+    uint16_t opcode;
+    uint16_t I; /* State after the instruction */
+    uint16_t SP;
+    uint8_t V[16];
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t pad[2];
+} emuTraceRecord;
+
+/* Trace dump file header, followed by count records oldest first */
+#define traceMagic "SCTR"
+#define traceVersion 1
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t count;
+} emuTraceHeader;
+
+/* Input log file, see input.c for the layout */
+#define inputMagic "SCIN"
+#define inputVersion 2
+
+/* Tracing is compiled in with -DSUNCHIP_TRACE and switched on per instance
+ * with initTrace() */
+#ifdef SUNCHIP_TRACE
+#define traceActive(chip8) ((chip8)->trace != NULL)
+#else
+#define traceActive(chip8) 0
+#endif
+
+/* Profiler counters - public so the hot paths can bump them in place */
+#define profileOps 4096 /* Opcode family (high nibble) << 8 | sub-opcode */
+struct emuProfile {
+    uint64_t ops[profileOps];
+    uint64_t pc[maxRam]; /* Instructions fetched from each address */
+    uint64_t drawRows[16]; /* draw() calls by sprite height */
+    uint64_t drawNanos; /* Wall time spent in draw() */
+    uint64_t runNanos; /* Wall time spent in runInstructions() */
+};
+
+/* Profiling is compiled in with -DSUNCHIP_PROFILE and switched on per
+ * instance with initProfile() */
+#ifdef SUNCHIP_PROFILE
+#define profileActive(chip8) ((chip8)->profile != NULL)
+#else
+#define profileActive(chip8) 0
+#endif
+
+/* Pre-decoded instruction, cached per address */
+typedef struct emuDecoded emuDecoded;
+struct emuDecoded {
+    void (*handler)(chip8 *chip8, const emuDecoded *op); /* NULL = not decoded yet */
+    uint16_t opcode; /* Raw instruction */
+    uint16_t NNN; /* Address */
+    uint8_t x; /* 4-bit register identifier */
+    uint8_t y; /* 4-bit register identifier */
+    uint8_t N; /* 4-bit constant */
+    uint8_t NN; /* 8-bit constant */
+    bool idle; /* Can start an idle loop, see skipIdle() */
+};
+
+/* Host callbacks - any of them may be NULL */
 typedef struct {
+    void (*video)(void *userData, const chip8 *chip8); /* A frame has been completed */
+    void (*audio)(void *userData, bool beep); /* Beep started or stopped */
+    void (*input)(void *userData, chip8 *chip8); /* Update keypad (or queueKey()) before a frame */
+    void *userData; /* Passed back to every callback */
+} emuCallbacks;
+
+/* CHIP-8 "emulator" object  */
+struct chip8 {
+#ifdef SUNCHIP_PAGED_RAM
+    uint8_t *pages[ramPages]; /* Memory - shared image pages until written, see ramByte() */
+    uint32_t ownedPages[ramPages / 32]; /* Pages copied into this instance */
+#else
     uint8_t ram[maxRam]; /* Memory */
-    bool vram[displayWidth * displayHeight]; /* Video memory */
-    bool vram2[displayWidth * displayHeight]; /* Second video memory */
-    EMUBM bitMask; /* Display bitmask */
+#endif
+    const emuImage *image; /* Font + ROM to map instead of loading, NULL = load romFile */
+    const emuPack *pack; /* ROM pack romFile names (or hashes) a ROM in, NULL = romFile is a path */
+    uint64_t vram[hiresHeight][vramWords]; /* Video memory - one bit per pixel, see vramPixel() */
+    uint64_t vram2[hiresHeight][vramWords]; /* Second video memory - XO-CHIP plane 2 */
+    EMUBM bitMask; /* Display bitmask - planes selected by Fn01 */
+    bool hires; /* 128x64 mode, set by 00FF and cleared by 00FE */
+    bool vramDirty; /* Screen changed since the last takeDirty() */
+    uint8_t dirtyTop; /* Rows dirtyTop to dirtyBottom hold every change, when vramDirty */
+    uint8_t dirtyBottom;
     uint16_t stack[12]; /* Call stack */
     uint8_t V[16]; /* 8-bit general registers V0 - VF */
     uint16_t I; /* 16-bit index register */
     uint16_t PC; /* 16-bit program counter - Stores current address */
     uint16_t SP; /* 16-bit stack pointer - Points to call stack */
-    uint8_t delayTimer; /* 8-bit delay timer - Decrements at 60hz when non-zero */
+    uint8_t delayTimer; /* 8-bit delay timer - Decrements at 60hz when non-zero, counted lazily, see updateTimers() */
     uint8_t soundTimer; /* 8-bit sound timer - Also decrements at 60hz but plays tone when non-zero */
     uint8_t pitch; /* 8-bit audio pitch register */
     EMUKEYS keypad[defaultKeys]; /* Hexadecimal keypad with layout:            [1|2|3|C] */
@@ -64,13 +219,231 @@ typedef struct {
     long refreshMaxCycles;
     long refreshCycles;
     long cycleTime;
+    uint64_t timerInstr; /* instrCount the timers were last caught up to */
+    uint64_t soundOff; /* instrCount the beep stops at */
 
     const char *rom; /* .ch8 ROM that is running in the emulator */
     uint16_t pcStart; /* Load CHIP-8 roms to 0x200 (512) */
-    bool quirks[defaultQuirks];
+    bool quirks[defaultQuirks]; /* Indexed by EMUQUIRK - call applyQuirks() after changing */
+    EMUPLATFORM platform; /* Quirk preset initEmu() loads */
+    const emuQuirkOps *quirkOps; /* Interpreter variant for quirks */
     bool beep; /* Produce sound */
     bool fakeLcd; /* Simulate LCD */
     bool exit; /* Exit the interpreter */
-} chip8;
+    bool paused; /* runInstructions() does nothing while set */
+    bool noIdleSkip; /* Run idle loops instruction by instruction - for benchmarks */
+    uint32_t seed; /* PRNG seed for CxNN, 0 = pick one in initEmu() */
+    uint32_t rng; /* PRNG state */
+    emuCallbacks callbacks; /* Video, audio and input hooks for the host */
+    EMUENGINE engine; /* Which interpreter runs execute() */
+    emuDecoded *decodeCache; /* maxRam entries, allocated by initEmu() */
+    emuJit *jit; /* Allocated when engineJit is selected */
+    emuTrace *trace; /* Allocated by initTrace() */
+    emuProfile *profile; /* Allocated by initProfile() */
+    emuAudio *audio; /* Allocated by initAudio() */
+    emuInput *inputLog; /* Allocated by recordInput() or replayInput() */
+    emuKeyEvent keyQueue[keyQueueSize]; /* Key events for the next frame */
+    unsigned long keyHead; /* Events queued - host thread */
+    unsigned long keyTail; /* Events taken - emulation thread */
+    uint64_t instrCount; /* Instructions retired since reset */
+    uint32_t dirtyPages[ramPages / 32]; /* RAM pages written since the last saveState() */
+    uint32_t stateSerial; /* Bumped by every saveState() */
+};
+
+/* Read-only RAM access that works with either memory model - writes go
+ * through writeRam() or storeRam(). -DSUNCHIP_PAGED_RAM changes the
+ * layout of struct chip8, so build the library and hosts alike. */
+#ifdef SUNCHIP_PAGED_RAM
+#define ramByte(chip8, addr) ((chip8)->pages[((addr) >> 8) & 0xFF][(addr) & 0xFF])
+#define ramPage(chip8, page) ((const uint8_t *)(chip8)->pages[page])
+#else
+#define ramByte(chip8, addr) ((chip8)->ram[(uint16_t)(addr)])
+#define ramPage(chip8, page) ((const uint8_t *)&(chip8)->ram[(page) * ramPageSize])
+#endif
+
+/* Mark the RAM page holding addr as written */
+#define markDirty(chip8, addr) ((chip8)->dirtyPages[(addr) >> 13] |= 1u << (((addr) >> 8) & 31))
+
+/* Everything in a save state except memory */
+typedef struct {
+    uint16_t stack[12];
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint16_t SP;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t pitch;
+    EMUBM bitMask;
+    bool hires;
+    EMUKEYS keypad[defaultKeys];
+    bool quirks[defaultQuirks];
+    bool beep;
+    bool exit;
+    long cpuCycles;
+    long soundCycles;
+    long delayCycles;
+    long refreshCycles;
+    uint64_t instrCount;
+    uint32_t rng;
+} emuRegs;
+
+/* Save state - a full copy of the machine that saveState() keeps up to
+ * date by copying only the RAM pages written since the previous save */
+#define stateMagic "SCST"
+#define stateVersion 3
+typedef struct {
+    emuRegs regs;
+    uint64_t vram[hiresHeight][vramWords];
+    uint64_t vram2[hiresHeight][vramWords];
+    uint8_t ram[maxRam];
+    uint32_t pages[ramPages / 32]; /* Pages copied by the last saveState() */
+    const chip8 *owner; /* Instance this state is in sync with, if any */
+    uint32_t serial; /* owner->stateSerial at the time of the save */
+} emuState;
+
+/* Setup */
+bool initEmu(chip8 *chip8, const char romFile[]);
+void freeEmu(chip8 *chip8);
+void reset(chip8 *chip8);
+void loadFont(chip8 *chip8);
+bool loadRom(chip8 *chip8, const char romFile[]);
+void setCpuSpeed(chip8 *chip8, unsigned long cpuHz);
+void setTimerSpeed(chip8 *chip8, unsigned long timerHz);
+void setRefreshSpeed(chip8 *chip8, unsigned long refreshHz);
+void setPlatform(chip8 *chip8, EMUPLATFORM platform);
+void applyQuirks(chip8 *chip8);
+
+/* Stepping */
+void execute(chip8 *chip8);
+bool setEngine(chip8 *chip8, EMUENGINE engine);
+void flushDecodeCache(chip8 *chip8);
+bool cycle(chip8 *chip8);
+void updateTimers(chip8 *chip8);
+void resyncTimers(chip8 *chip8);
+void draw(chip8 *chip8, uint8_t x, uint8_t y, uint8_t N);
+unsigned long runInstructions(chip8 *chip8, unsigned long count);
+unsigned long runFrame(chip8 *chip8);
+
+/* Recompiler (jit.c) */
+bool initJit(chip8 *chip8);
+void freeJit(chip8 *chip8);
+void jitFlush(chip8 *chip8);
+void jitInvalidate(chip8 *chip8, uint16_t addr);
+unsigned long jitRun(chip8 *chip8, unsigned long budget);
+
+/* Tracing (trace.c) */
+bool initTrace(chip8 *chip8, unsigned long records);
+void freeTrace(chip8 *chip8);
+void traceRecord(chip8 *chip8, uint16_t addr, uint16_t opcode);
+unsigned long traceDump(const chip8 *chip8, FILE *file, unsigned long count);
+
+/* Audio (audio.c) */
+bool initAudio(chip8 *chip8, unsigned long sampleRate);
+void freeAudio(chip8 *chip8);
+void audioPush(chip8 *chip8);
+void audioRender(emuAudio *audio, float *samples, unsigned long count);
+
+/* Input logs (input.c) */
+bool recordInput(chip8 *chip8, FILE *file);
+bool replayInput(chip8 *chip8, FILE *file);
+void stopInput(chip8 *chip8);
+bool inputDone(const chip8 *chip8);
+unsigned inputFrame(chip8 *chip8, emuKeyEvent *keys, unsigned count);
+void inputEndFrame(chip8 *chip8);
+
+/* Profiling (profile.c) */
+bool initProfile(chip8 *chip8);
+void freeProfile(chip8 *chip8);
+uint64_t profileNanos(void);
+unsigned profileKey(uint16_t opcode);
+void profileReport(const chip8 *chip8, FILE *file);
+void profileFolded(const chip8 *chip8, FILE *file);
+
+/* Memory (memory.c) */
+uint8_t *writablePage(chip8 *chip8, unsigned page);
+void freePages(chip8 *chip8);
+void mapImage(chip8 *chip8, const emuImage *image);
+void storeRam(chip8 *chip8, uint16_t addr, const void *data, unsigned long length);
+void mapRam(chip8 *chip8, uint16_t addr, const uint8_t *data, unsigned long length);
+void writeRam(chip8 *chip8, uint16_t addr, uint8_t value);
+emuImage *createImage(const chip8 *chip8);
+void freeImage(emuImage *image);
+
+/* Save states (state.c) */
+unsigned long saveState(chip8 *chip8, emuState *state);
+void copyState(const chip8 *chip8, emuState *state);
+unsigned long loadState(chip8 *chip8, emuState *state);
+bool writeState(const emuState *state, FILE *file);
+bool readState(emuState *state, FILE *file);
+void ramChanged(chip8 *chip8, uint16_t addr, unsigned long length);
+
+/* Rewind (rewind.c) */
+emuRewind *createRewind(size_t capBytes);
+void freeRewind(emuRewind *history);
+void rewindPush(emuRewind *history, chip8 *chip8);
+bool rewindPop(emuRewind *history, chip8 *chip8);
+unsigned long rewindFrames(const emuRewind *history);
+
+/* One ROM in a pack, pointing into the mapping */
+#define packMagic "SCPK"
+#define packVersion 1
+#define packNameSize 88 /* Name field, NUL included */
+typedef struct {
+    const char *name;
+    const uint8_t *sha1; /* 20 bytes */
+    const uint8_t *data; /* size bytes, zero padded to whole RAM pages */
+    unsigned long size;
+    unsigned long cpuHz; /* Suggested speed, 0 = none */
+    EMUPLATFORM platform; /* Suggested quirk preset, platformCustom = none */
+} emuPackRom;
+
+/* ROM packs (pack.c) */
+emuPack *openPack(const char *path);
+void closePack(emuPack *pack);
+unsigned long packCount(const emuPack *pack);
+bool packRom(const emuPack *pack, unsigned long index, emuPackRom *rom);
+bool findPackRom(const emuPack *pack, const char *key, emuPackRom *rom);
+bool loadPackRom(chip8 *chip8, const emuPack *pack, const char *key);
+void sha1(const void *data, unsigned long length, uint8_t digest[20]);
+
+/* A completed frame, as handed from the emulation thread to a renderer -
+ * beeps go through the audio event ring, see audioPush() */
+typedef struct {
+    uint64_t vram[hiresHeight][vramWords];
+    uint64_t vram2[hiresHeight][vramWords];
+    int dirtyTop; /* Rows changed since the last frame the renderer took, */
+    int dirtyBottom; /* none if dirtyBottom < dirtyTop */
+    bool hires;
+    bool fakeLcd;
+} emuFrame;
+
+/* Video (video.c) */
+uint64_t hashVram(const chip8 *chip8);
+void expandVram(const chip8 *chip8, void *pixels, int pitch, const uint32_t palette[4]);
+void expandFrame(const emuFrame *frame, int top, int bottom, void *pixels, int pitch, const uint32_t palette[4]);
+void vramChanged(chip8 *chip8, int top, int bottom);
+bool takeDirty(chip8 *chip8, int *top, int *bottom);
+emuFrames *createFrames(void);
+void freeFrames(emuFrames *frames);
+bool publishFrame(emuFrames *frames, chip8 *chip8);
+const emuFrame *latestFrame(emuFrames *frames);
+
+/* Video capture stream formats */
+typedef enum {
+    captureY4m, /* YUV4MPEG2, 4:4:4 */
+    captureRgba /* Raw RGBA, 4 bytes a pixel */
+} EMUCAPTURE;
+
+/* Video capture (capture.c) */
+emuCapture *startCapture(const chip8 *chip8, FILE *file, EMUCAPTURE format, int scale, const uint32_t palette[4]);
+bool captureFrame(emuCapture *capture, const chip8 *chip8);
+bool stopCapture(emuCapture *capture);
+
+/* Input */
+void resetKeypad(chip8 *chip8);
+void resetReleased(chip8 *chip8);
+bool queueKey(chip8 *chip8, uint8_t key, bool down, uint32_t offset);
+unsigned takeKeys(chip8 *chip8, emuKeyEvent *keys);
 
 #endif
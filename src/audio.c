@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Beeper synthesis
+ *
+ * The emulation thread publishes sound on/off events stamped with emulated
+ * time into a single producer, single consumer ring; the host's audio
+ * callback renders them with audioRender(). Neither side locks, allocates
+ * or makes system calls. Events are played a fixed latency after the first
+ * one heard, so a frame's worth of instructions run in a burst still beeps
+ * with sample accurate spacing.
+ *
+ * Sound is the XO-CHIP 128 bit pattern at audioStartDefault played at
+ * 4000 * 2^((pitch - 64) / 48) bits per second. Each event carries the
+ * whole pattern, which is expanded a byte at a time through a lookup table
+ * into a 128 sample wavetable; rendering is then one table read per sample
+ * with no per-bit branches.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+#define audioRing 256 /* Events in flight, power of two */
+#define waveSize (audioSize * 8) /* One sample per pattern bit */
+#define waveShift 25 /* Phase bits below the wavetable index */
+#define patternHz 4000.0 /* Bit rate at defaultPitch */
+#define pitchRatio 1.0145453349375237 /* 2^(1/48) */
+#define beepVolume 0.25f
+
+typedef struct {
+    uint64_t time; /* Emulated time in samples */
+    uint8_t pattern[audioSize];
+    uint8_t pitch;
+    bool on;
+} audioEvent;
+
+struct emuAudio {
+    /* Written by the emulation thread */
+    audioEvent events[audioRing];
+    unsigned long head; /* Events published */
+    uint64_t micros; /* Emulated time of lastInstr */
+    uint64_t lastInstr;
+
+    /* Read by the audio thread */
+    unsigned long tail; /* Events consumed */
+    uint64_t cursor; /* Samples rendered */
+    int64_t offset; /* Event time - cursor time */
+    bool synced; /* offset has been picked */
+    bool on;
+    uint32_t phase; /* 7.25 fixed point wavetable position */
+    uint32_t step;
+    float wave[waveSize]; /* Current pattern, one sample per bit */
+
+    unsigned long sampleRate;
+    unsigned long latency; /* Samples between an event and hearing it */
+    uint32_t steps[256]; /* Phase step per pitch */
+    float expand[256][8]; /* Pattern byte to eight samples, MSB first */
+};
+
+/* Attach a beeper rendering at sampleRate to chip8 */
+bool initAudio(chip8 *chip8, unsigned long sampleRate) {
+    emuAudio *audio;
+    int i;
+
+    freeAudio(chip8);
+
+    audio = calloc(1, sizeof *audio);
+    if (!audio) return 0; /* false */
+
+    audio->sampleRate = sampleRate;
+    audio->latency = sampleRate * 2 / defaultRefreshHz; /* Two frames of bursty emulation */
+    audio->lastInstr = chip8->instrCount;
+
+    /* Bit rate doubles every 48 pitch steps, walk out from defaultPitch */
+    {
+        double up = patternHz, down = patternHz;
+        for (i = 0; i < 256 - defaultPitch; i++, up *= pitchRatio) {
+            audio->steps[defaultPitch + i] = (uint32_t)(up * (1 << waveShift) / sampleRate);
+        }
+        for (i = 1; i <= defaultPitch; i++) {
+            down /= pitchRatio;
+            audio->steps[defaultPitch - i] = (uint32_t)(down * (1 << waveShift) / sampleRate);
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        int bit;
+        for (bit = 0; bit < 8; bit++) {
+            audio->expand[i][bit] = (i << bit) & 0x80 ? beepVolume : -beepVolume;
+        }
+    }
+
+    chip8->audio = audio;
+    return 1; /* true */
+}
+
+/* Stop the host's audio callback before calling this */
+void freeAudio(chip8 *chip8) {
+    free(chip8->audio);
+    chip8->audio = NULL;
+}
+
+/* Publish the sound state (beep, pattern, pitch) as of the current
+ * instruction - emulation thread only */
+void audioPush(chip8 *chip8) {
+    emuAudio *audio = chip8->audio;
+    const unsigned long head = audio->head;
+    audioEvent *event = &audio->events[head & (audioRing - 1)];
+
+    /* Emulated time only moves forward - a rewind or load just stops counting */
+    if (chip8->instrCount > audio->lastInstr) {
+        audio->micros += (chip8->instrCount - audio->lastInstr) * chip8->cycleTime;
+    }
+    audio->lastInstr = chip8->instrCount;
+
+    /* Full means the audio thread is stalled, nothing to keep in time with */
+    if (head - __atomic_load_n(&audio->tail, __ATOMIC_ACQUIRE) >= audioRing) return;
+
+    event->time = audio->micros * audio->sampleRate / earthSecond;
+    memcpy(event->pattern, ramPage(chip8, audioStartDefault / ramPageSize) + audioStartDefault % ramPageSize, audioSize);
+    event->pitch = chip8->pitch;
+    event->on = chip8->beep;
+
+    /* Event contents must be visible before the new head */
+    __atomic_store_n(&audio->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Switch to the sound state in event */
+static void apply(emuAudio *audio, const audioEvent *event) {
+    int i;
+
+    for (i = 0; i < audioSize; i++) {
+        memcpy(&audio->wave[i * 8], audio->expand[event->pattern[i]], sizeof audio->expand[0]);
+    }
+
+    audio->step = audio->steps[event->pitch];
+    audio->on = event->on;
+}
+
+/* Write count mono float samples - audio thread only */
+void audioRender(emuAudio *audio, float *samples, unsigned long count) {
+    while (count > 0) {
+        const unsigned long tail = audio->tail;
+        unsigned long run = count, i;
+        bool event = tail != __atomic_load_n(&audio->head, __ATOMIC_ACQUIRE);
+        uint64_t at = 0;
+
+        if (event) {
+            const int64_t time = (int64_t)audio->events[tail & (audioRing - 1)].time;
+
+            /* Lock on to the first event, and again if the emulator got
+             * far ahead of the device or fell behind it - a pause, rewind
+             * or stall leaves every later event late otherwise */
+            if (!audio->synced || time - audio->offset > (int64_t)(audio->cursor + audio->latency * 4) ||
+                time - audio->offset < (int64_t)audio->cursor - (int64_t)audio->latency) {
+                audio->offset = time - (int64_t)(audio->cursor + audio->latency);
+                audio->synced = true;
+            }
+
+            /* Late events play now */
+            at = time - audio->offset < (int64_t)audio->cursor ? audio->cursor : (uint64_t)(time - audio->offset);
+            if (at - audio->cursor < run) {
+                run = at - audio->cursor;
+            }
+            else {
+                event = false;
+            }
+        }
+
+        if (audio->on) {
+            for (i = 0; i < run; i++) {
+                samples[i] = audio->wave[audio->phase >> waveShift];
+                audio->phase += audio->step;
+            }
+        }
+        else {
+            memset(samples, 0, run * sizeof *samples);
+        }
+
+        samples += run;
+        count -= run;
+        audio->cursor += run;
+
+        if (event) {
+            apply(audio, &audio->events[tail & (audioRing - 1)]);
+            __atomic_store_n(&audio->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
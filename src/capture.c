@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Headless video capture
+ *
+ * Each captured frame is the packed VRAM planes, about 2 KiB, copied into a
+ * bounded queue; an encoder thread expands it at the chosen scale and
+ * writes it, so the emulation loop never waits on conversion or disk I/O
+ * unless the encoder falls captureQueueSize frames behind. The stream is
+ * always hiresWidth x hiresHeight times scale, low-res frames are doubled.
+ *
+ *     captureY4m   YUV4MPEG2 4:4:4 (BT.601, limited range) at refreshHz
+ *     captureRgba  bare R G B A bytes, frame after frame
+ */
+
+#define _POSIX_C_SOURCE 200112L /* pthreads */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+#define captureQueueSize 64 /* Frames the encoder may fall behind */
+
+struct emuCapture {
+    FILE *file; /* The caller's */
+    EMUCAPTURE format;
+    int scale;
+    uint8_t colors[4][4]; /* Per palette index: R G B A, or Y U V */
+
+    /* Encoder thread only */
+    uint32_t pixels[hiresHeight][hiresWidth]; /* Palette indices, from expandFrame() */
+    emuFrame last; /* Last frame encoded, to spot repeats */
+    bool encoded; /* out holds last */
+    uint8_t *out;
+    size_t outSize;
+
+    /* Shared, under lock */
+    emuFrame queue[captureQueueSize];
+    unsigned long head; /* Frames queued */
+    unsigned long tail; /* Frames written */
+    bool stopping;
+    bool failed; /* A write failed, later frames are dropped */
+    pthread_mutex_t lock;
+    pthread_cond_t queued; /* Signalled when head moves */
+    pthread_cond_t written; /* Signalled when tail moves */
+    pthread_t thread;
+};
+
+/* Expand one queued frame into out - a static screen reuses the last one */
+static void encodeFrame(emuCapture *capture, const emuFrame *frame) {
+    static const uint32_t indices[4] = {0, 1, 2, 3};
+    const int factor = capture->scale * (frame->hires ? 1 : 2);
+    const int width = screenWidth(frame), height = screenHeight(frame);
+    const size_t outWidth = (size_t)hiresWidth * capture->scale;
+    const size_t planeSize = outWidth * hiresHeight * capture->scale;
+    int x, y, k;
+
+    if (capture->encoded && frame->hires == capture->last.hires &&
+        !memcmp(frame->vram, capture->last.vram, sizeof frame->vram) &&
+        !memcmp(frame->vram2, capture->last.vram2, sizeof frame->vram2)) {
+        return;
+    }
+
+    expandFrame(frame, 0, height - 1, capture->pixels, sizeof capture->pixels[0], indices);
+
+    /* Build each source row's first output line, then repeat it */
+    for (y = 0; y < height; y++) {
+        const uint32_t *row = capture->pixels[y];
+
+        if (capture->format == captureRgba) {
+            const size_t pitch = outWidth * 4;
+            uint8_t *line = capture->out + y * factor * pitch, *p = line;
+
+            for (x = 0; x < width; x++) {
+                for (k = 0; k < factor; k++, p += 4) memcpy(p, capture->colors[row[x]], 4);
+            }
+            for (k = 1; k < factor; k++) memcpy(line + k * pitch, line, pitch);
+        }
+        else {
+            int c;
+
+            for (c = 0; c < 3; c++) {
+                uint8_t *line = capture->out + c * planeSize + y * factor * outWidth, *p = line;
+
+                for (x = 0; x < width; x++, p += factor) memset(p, capture->colors[row[x]][c], factor);
+                for (k = 1; k < factor; k++) memcpy(line + k * outWidth, line, outWidth);
+            }
+        }
+    }
+
+    capture->last = *frame;
+    capture->encoded = true;
+}
+
+static void *encoder(void *data) {
+    emuCapture *capture = data;
+
+    pthread_mutex_lock(&capture->lock);
+    for (;;) {
+        const emuFrame *frame;
+        bool ok;
+
+        while (capture->head == capture->tail && !capture->stopping) {
+            pthread_cond_wait(&capture->queued, &capture->lock);
+        }
+        if (capture->head == capture->tail) break;
+
+        /* The slot stays queued, and so untouched, until it is written */
+        frame = &capture->queue[capture->tail % captureQueueSize];
+        ok = !capture->failed;
+        pthread_mutex_unlock(&capture->lock);
+
+        if (ok) {
+            encodeFrame(capture, frame);
+            if (capture->format == captureY4m) ok = fputs("FRAME\n", capture->file) >= 0;
+            ok = ok && fwrite(capture->out, capture->outSize, 1, capture->file) == 1;
+        }
+
+        pthread_mutex_lock(&capture->lock);
+        if (!ok) capture->failed = true;
+        capture->tail++;
+        pthread_cond_signal(&capture->written);
+    }
+    pthread_mutex_unlock(&capture->lock);
+
+    return NULL;
+}
+
+/* Start capturing to file at scale times hiresWidth x hiresHeight, in
+ * palette's colors (RGBA8888, see expandVram()) - call after initEmu()
+ * so refreshHz is settled. The file stays the caller's. */
+emuCapture *startCapture(const chip8 *chip8, FILE *file, EMUCAPTURE format, int scale, const uint32_t palette[4]) {
+    emuCapture *capture;
+    int i;
+
+    if (scale < 1) return NULL;
+
+    capture = calloc(1, sizeof *capture);
+    if (!capture) return NULL;
+
+    capture->file = file;
+    capture->format = format;
+    capture->scale = scale;
+    capture->outSize = (size_t)hiresWidth * hiresHeight * scale * scale * (format == captureY4m ? 3 : 4);
+    capture->out = malloc(capture->outSize);
+    if (!capture->out) {
+        free(capture);
+        return NULL;
+    }
+
+    for (i = 0; i < 4; i++) {
+        const int r = (palette[i] >> 24) & 0xFF, g = (palette[i] >> 16) & 0xFF, b = (palette[i] >> 8) & 0xFF;
+
+        if (format == captureY4m) {
+            /* Offsets keep the sums positive before the shift */
+            capture->colors[i][0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            capture->colors[i][1] = (-38 * r - 74 * g + 112 * b + 32896) >> 8;
+            capture->colors[i][2] = (112 * r - 94 * g - 18 * b + 32896) >> 8;
+        }
+        else {
+            capture->colors[i][0] = r;
+            capture->colors[i][1] = g;
+            capture->colors[i][2] = b;
+            capture->colors[i][3] = palette[i] & 0xFF;
+        }
+    }
+
+    if (format == captureY4m &&
+        fprintf(file, "YUV4MPEG2 W%d H%d F%lu:1 Ip A1:1 C444\n", hiresWidth * scale, hiresHeight * scale,
+                chip8->refreshHz ? chip8->refreshHz : (unsigned long)defaultRefreshHz) < 0) {
+        free(capture->out);
+        free(capture);
+        return NULL;
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->queued, NULL);
+    pthread_cond_init(&capture->written, NULL);
+    if (pthread_create(&capture->thread, NULL, encoder, capture)) {
+        pthread_cond_destroy(&capture->written);
+        pthread_cond_destroy(&capture->queued);
+        pthread_mutex_destroy(&capture->lock);
+        free(capture->out);
+        free(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+/* Queue chip8's screen as the next frame - after each runFrame(). Only
+ * waits if the encoder is a whole queue behind. False once a write has
+ * failed. */
+bool captureFrame(emuCapture *capture, const chip8 *chip8) {
+    emuFrame *frame;
+    bool ok;
+
+    pthread_mutex_lock(&capture->lock);
+    while (capture->head - capture->tail >= captureQueueSize) {
+        pthread_cond_wait(&capture->written, &capture->lock);
+    }
+    frame = &capture->queue[capture->head % captureQueueSize];
+    ok = !capture->failed;
+    pthread_mutex_unlock(&capture->lock);
+
+    /* Not yet queued, so the encoder won't look at the slot */
+    memcpy(frame->vram, chip8->vram, sizeof frame->vram);
+    memcpy(frame->vram2, chip8->vram2, sizeof frame->vram2);
+    frame->hires = chip8->hires;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->head++;
+    pthread_cond_signal(&capture->queued);
+    pthread_mutex_unlock(&capture->lock);
+
+    return ok;
+}
+
+/* Write whatever is still queued and stop. False if any write failed. */
+bool stopCapture(emuCapture *capture) {
+    bool ok;
+
+    if (!capture) return 1; /* true */
+
+    pthread_mutex_lock(&capture->lock);
+    capture->stopping = true;
+    pthread_cond_signal(&capture->queued);
+    pthread_mutex_unlock(&capture->lock);
+
+    pthread_join(capture->thread, NULL);
+    ok = !capture->failed && !fflush(capture->file);
+
+    pthread_cond_destroy(&capture->written);
+    pthread_cond_destroy(&capture->queued);
+    pthread_mutex_destroy(&capture->lock);
+    free(capture->out);
+    free(capture);
+    return ok;
+}
@@ -29,10 +29,6 @@ typedef struct {
     bool fakeLcd; /* Simulate LCD */
 } emuConfig;
 
-bool quit = false;
-bool paused = false;
-bool quirks[defaultQuirks] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
-
 void loadFont(chip8 *chip8) {
     const uint8_t font[] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, /* 0 */
@@ -52,80 +48,291 @@ void loadFont(chip8 *chip8) {
         0xF0, 0x80, 0xF0, 0x80, 0xF0, /* E */
         0xF0, 0x80, 0xF0, 0x80, 0x80  /* F */
     };
-    memcpy(&chip8->ram[0], font, sizeof(font));
+    const uint8_t bigFont[] = { /* SUPER-CHIP 8x10 digits, XO-CHIP adds A - F */
+        0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, /* 0 */
+        0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, /* 1 */
+        0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, /* 2 */
+        0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, /* 3 */
+        0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, /* 4 */
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, /* 5 */
+        0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, /* 6 */
+        0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, /* 7 */
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, /* 8 */
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, /* 9 */
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, /* A */
+        0xFE, 0xFF, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xC3, 0xFF, 0xFE, /* B */
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, /* C */
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, /* D */
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, /* E */
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  /* F */
+    };
+    uint8_t pattern[audioSize];
+
+    storeRam(chip8, fontStartDefault, font, sizeof(font));
+    storeRam(chip8, bigFontStartDefault, bigFont, sizeof(bigFont));
+
+    /* XO-CHIP audio pattern, a 500hz square until F002 */
+    memset(pattern, 0xF0, sizeof pattern);
+    storeRam(chip8, audioStartDefault, pattern, sizeof pattern);
 };
 
+/* Every instruction is cycleTime of emulated time - the timers count at
+ * the old rate up to the change */
+static void setCycleTime(chip8 *chip8, long cycleTime) {
+    if (cycleTime == chip8->cycleTime) return;
+
+    updateTimers(chip8);
+    chip8->cycleTime = cycleTime;
+    resyncTimers(chip8);
+}
+
 void setCpuSpeed(chip8 *chip8, unsigned long cpuHz) {
     chip8->cpuHz = cpuHz;
 
     if (cpuHz > 0) {
         chip8->cpuMaxCycles = earthSecond / chip8->cpuHz;
     }
+    setCycleTime(chip8, cpuHz ? chip8->cpuMaxCycles : earthSecond / defaultSpeed);
 }
 
-void draw(chip8 *chip8, uint8_t x, uint8_t y, uint8_t N) {
-    const uint8_t xStart = x; /* Original X */
+void setTimerSpeed(chip8 *chip8, unsigned long timerHz) {
+    updateTimers(chip8);
+    chip8->timerHz = timerHz;
+
+    if (timerHz > 0) {
+        chip8->timerMaxCycles = earthSecond / chip8->timerHz;
+    }
+    resyncTimers(chip8);
+}
 
-    chip8->V[0x0F] = 0; /* Initialize carry flag to 0 */
+void setRefreshSpeed(chip8 *chip8, unsigned long refreshHz) {
+    chip8->refreshHz = refreshHz;
 
-    uint8_t i; int8_t j; /* Please clean this up. */
+    if (refreshHz > 0) {
+        chip8->refreshMaxCycles = earthSecond / chip8->refreshHz;
+    }
+}
 
-    for (i = 0; i < N; i++) {
-        const uint8_t spriteData = chip8->ram[chip8->I + i];
-        x = xStart; /* Reset X for next row */
+/* Line a sprite row up at column x of a width pixel screen row - bits
+ * past the right edge fall off, or come back on the left when wrapping */
+static void placeRow(uint64_t out[vramWords], uint64_t bits, int bitsWide, uint8_t x, int width, bool wrap) {
+    const uint64_t left = bits << (64 - bitsWide); /* Lined up with the left edge */
 
-        for (j = 7; j >= 0; j--) {
-            /* If sprite pixel and display pixel are on, set carry flag */
-            bool *pixel = &chip8->vram[y * displayWidth + x];
-            const bool spriteBit = (spriteData & (1 << j));
+    if (x < 64) {
+        out[0] = left >> x;
+        out[1] = x ? left << (64 - x) : 0;
+    }
+    else {
+        out[0] = 0;
+        out[1] = left >> (x - 64);
+    }
 
-            if (spriteBit && *pixel) {
-                chip8->V[0x0F] = 1;
-            }
+    if (width == displayWidth) {
+        out[1] = 0; /* Low-res rows are one word */
+    }
+
+    if (wrap && x > width - bitsWide) {
+        out[0] |= left << (width - x);
+    }
+}
+
+/* Handlers whose behaviour depends on quirks, one table per variant */
+struct emuQuirkOps {
+    void (*draw)(chip8 *chip8, uint8_t x, uint8_t y, uint8_t N);
+    void (*drw)(chip8 *chip8, const emuDecoded *op);
+    void (*orReg)(chip8 *chip8, const emuDecoded *op);
+    void (*andReg)(chip8 *chip8, const emuDecoded *op);
+    void (*xorReg)(chip8 *chip8, const emuDecoded *op);
+    void (*shr)(chip8 *chip8, const emuDecoded *op);
+    void (*shl)(chip8 *chip8, const emuDecoded *op);
+    void (*jumpV0)(chip8 *chip8, const emuDecoded *op);
+    void (*store)(chip8 *chip8, const emuDecoded *op);
+    void (*load)(chip8 *chip8, const emuDecoded *op);
+};
+
+/* Quirks of each preset, indexed by EMUQUIRK */
+static const bool platformQuirks[][defaultQuirks] = {
+    {0},                /* platformCustom - unused */
+    {0, 1, 1, 0, 1},    /* platformChip8: shift Vy, I advances, VF reset */
+    {0, 0, 0, 1, 0},    /* platformSuperChip: shift in place, BXNN */
+    {1, 1, 1, 0, 0}     /* platformXoChip: wrap, shift Vy, I advances */
+};
+
+/* One variant per preset with its quirks fixed... */
+#define variant(name) name##Chip8
+#define quirkOn(quirk) (platformQuirks[platformChip8][quirk])
+#include "quirkops.h"
+
+#define variant(name) name##SuperChip
+#define quirkOn(quirk) (platformQuirks[platformSuperChip][quirk])
+#include "quirkops.h"
+
+#define variant(name) name##XoChip
+#define quirkOn(quirk) (platformQuirks[platformXoChip][quirk])
+#include "quirkops.h"
+
+/* ...and the generic one, reading them as it goes */
+#define variant(name) name##Generic
+#define quirkOn(quirk) (chip8->quirks[quirk])
+#include "quirkops.h"
+
+static const emuQuirkOps *const platformOps[] = {
+    &quirkOpsGeneric, &quirkOpsChip8, &quirkOpsSuperChip, &quirkOpsXoChip
+};
 
-            /* XOR display sprite pixel on or off */
-            *pixel ^= spriteBit;
+void draw(chip8 *chip8, uint8_t x, uint8_t y, uint8_t N) {
+    (chip8->quirkOps ? chip8->quirkOps->draw : drawSpriteGeneric)(chip8, x, y, N);
+}
+
+/* Pick the interpreter variant for chip8->quirks - a preset's own when
+ * they match one, the generic one otherwise. Call after changing quirks. */
+void applyQuirks(chip8 *chip8) {
+    const emuQuirkOps *ops = &quirkOpsGeneric;
+    int p;
 
-            /* Stop drawing if the screen edge is hit*/
-            if (++x >= displayWidth) break;
+    for (p = platformChip8; p <= platformXoChip; p++) {
+        if (!memcmp(chip8->quirks, platformQuirks[p], sizeof chip8->quirks)) {
+            ops = platformOps[p];
         }
+    }
+
+    /* Decoded instructions point at the old variant's handlers, and
+     * translated blocks have the old quirks baked in */
+    chip8->quirkOps = ops;
+    flushDecodeCache(chip8);
+}
 
-        /* Stop drawing screen if the bottom edge is hit */
-        if (++y >= displayHeight) break;
+/* Load a preset's quirks - platformCustom keeps the ones set by the host */
+void setPlatform(chip8 *chip8, EMUPLATFORM platform) {
+    chip8->platform = platform;
+
+    if (platform != platformCustom) {
+        memcpy(chip8->quirks, platformQuirks[platform], sizeof chip8->quirks);
     }
+    applyQuirks(chip8);
 }
 
-void loadRom(chip8 *chip8, const char romFile[]) {
-    /* Load ROM */
-    FILE *rom = fopen(romFile, "rb");
-    if (rom) {
-        fseek(rom, 0, SEEK_END);
-        const size_t romSize = ftell(rom);
-        const size_t maxSize = sizeof chip8->ram - pcStartDefault;
-        rewind(rom);
-
-        if (romSize > maxSize) {
-            printf("Rom file '%s' is %zu bytes too large!\n", romFile, romSize - maxSize);
-            return (void)-1;
+/* Clear the selected planes - 00E0 */
+static void clearPlanes(chip8 *chip8) {
+    if (chip8->bitMask & bm1) memset(chip8->vram, 0, sizeof chip8->vram);
+    if (chip8->bitMask & bm2) memset(chip8->vram2, 0, sizeof chip8->vram2);
+    if (chip8->bitMask) vramChanged(chip8, 0, screenHeight(chip8) - 1);
+}
+
+/* Switch resolution - the layouts differ, so both planes are cleared */
+static void setHires(chip8 *chip8, bool hires) {
+    chip8->hires = hires;
+    memset(chip8->vram, 0, sizeof chip8->vram);
+    memset(chip8->vram2, 0, sizeof chip8->vram2);
+    vramChanged(chip8, 0, screenHeight(chip8) - 1);
+}
+
+/* Move the selected planes n rows down (n < 0 is up), a memmove per plane.
+ * n is in pixels of the current mode. */
+static void scrollVertical(chip8 *chip8, int n) {
+    const int height = screenHeight(chip8);
+    const int moved = height - (n < 0 ? -n : n);
+    int p;
+
+    for (p = 0; p < 2; p++) {
+        uint64_t (*plane)[vramWords] = p ? chip8->vram2 : chip8->vram;
+
+        if (!(chip8->bitMask & (1 << p))) continue;
+
+        if (moved <= 0) {
+            memset(plane, 0, height * sizeof plane[0]);
+        }
+        else if (n > 0) {
+            memmove(plane[n], plane[0], moved * sizeof plane[0]);
+            memset(plane[0], 0, n * sizeof plane[0]);
         }
+        else {
+            memmove(plane[0], plane[-n], moved * sizeof plane[0]);
+            memset(plane[moved], 0, -n * sizeof plane[0]);
+        }
+    }
+
+    if (chip8->bitMask) vramChanged(chip8, 0, height - 1);
+}
+
+/* Move the selected planes 4 pixels right (or left), a shift per word */
+static void scrollHorizontal(chip8 *chip8, bool right) {
+    const int height = screenHeight(chip8);
+    int p, y;
 
-        /* Load ROM */
-        size_t ramDump = fread(&chip8->ram[pcStartDefault], romSize, 1, rom);
+    for (p = 0; p < 2; p++) {
+        uint64_t (*plane)[vramWords] = p ? chip8->vram2 : chip8->vram;
 
-        if (ramDump != 1) {
-            return (void)-1;
+        if (!(chip8->bitMask & (1 << p))) continue;
+
+        for (y = 0; y < height; y++) {
+            uint64_t *line = plane[y];
+
+            if (!chip8->hires) {
+                line[0] = right ? line[0] >> 4 : line[0] << 4;
+            }
+            else if (right) {
+                line[1] = (line[1] >> 4) | (line[0] << 60);
+                line[0] >>= 4;
+            }
+            else {
+                line[0] = (line[0] << 4) | (line[1] >> 60);
+                line[1] <<= 4;
+            }
         }
+    }
 
+    if (chip8->bitMask) vramChanged(chip8, 0, height - 1);
+}
+
+/* Load a .ch8 file at pcStartDefault - false if it is missing, can't be
+ * read or doesn't fit */
+bool loadRom(chip8 *chip8, const char romFile[]) {
+    const size_t maxSize = maxRam - pcStartDefault;
+    FILE *rom = fopen(romFile, "rb");
+    uint8_t *image;
+    long romSize;
+    bool ok;
+
+    if (!rom) {
+        printf("Invalid or missing rom file: %s\n", romFile);
+        return 0; /* false */
+    }
+
+    if (fseek(rom, 0, SEEK_END) || (romSize = ftell(rom)) < 0) {
+        printf("Could not read rom file: %s\n", romFile);
         fclose(rom);
+        return 0; /* false */
     }
-    else {
-        printf("Invalid or missing rom file: %s\n", romFile);
+    rewind(rom);
+
+    if ((size_t)romSize > maxSize) {
+        printf("Rom file '%s' is %lu bytes too large!\n", romFile, (unsigned long)(romSize - maxSize));
+        fclose(rom);
+        return 0; /* false */
     }
 
+    /* Load ROM */
+    image = malloc(romSize ? romSize : 1);
+    ok = image && (!romSize || fread(image, romSize, 1, rom) == 1);
+    fclose(rom);
+
+    if (!ok) {
+        printf("Could not read rom file: %s\n", romFile);
+        free(image);
+        return 0; /* false */
+    }
+
+    storeRam(chip8, pcStartDefault, image, romSize);
+    free(image);
+
     /* Set defaults */
     chip8->rom = romFile;
+    return 1; /* true */
 }
 
+/* Fx0A finishes on a key release, which it takes so the next Fx0A waits
+ * for another one */
 void keyWait (chip8 *chip8, uint8_t x) {
     bool releaseKey = false;
 
@@ -134,6 +341,7 @@ void keyWait (chip8 *chip8, uint8_t x) {
         if (chip8->keypad[i] == keyReleased) {
             /* Release key */
             chip8->V[x] = i;
+            chip8->keypad[i] = keyUp;
             releaseKey = true;
             break;
         }
@@ -168,46 +376,220 @@ void reset(chip8 *chip8){
     chip8->soundTimer = 0;
     chip8->pitch = defaultPitch;
 
+    chip8->instrCount = 0;
     chip8->cpuCycles = 0;
     chip8->soundCycles = 0;
     chip8->delayCycles = 0;
+    chip8->refreshCycles = 0;
 
     chip8->beep = false;
     chip8->exit = false;
+    resyncTimers(chip8);
 
+    /* Low-res, drawing on the first plane */
+    chip8->bitMask = bm1;
+    setHires(chip8, false);
 
     resetKeypad(chip8);
 }
 
+/* Timers are counted lazily. delayTimer, soundTimer and the time since
+ * their last tick (delayCycles, soundCycles) are kept as of timerInstr, and
+ * only caught up with the cycleTime per instruction retired since when
+ * something looks at them: Fx07, Fx15, Fx18, tracing, a change of speed
+ * and the end of runInstructions(). Ticks land every timerMaxCycles of
+ * emulated time, or every instruction with timerHz 0. The beep's end is
+ * worked out when Fx18 starts it, it sounds until instrCount reaches
+ * soundOff. */
+
+/* Instructions until a timer at value, cycles past its last tick, reaches 0 */
+static uint64_t stepsToZero(const chip8 *chip8, uint8_t value, long cycles) {
+    const int64_t left = (int64_t)value * chip8->timerMaxCycles - cycles;
+
+    if (!value) return 0;
+    if (!chip8->timerHz) return value;
+    return left > chip8->cycleTime ? (uint64_t)(left + chip8->cycleTime - 1) / chip8->cycleTime : 1;
+}
+
+/* Run a timer steps instructions on - a stopped timer doesn't count, and
+ * one that runs out keeps the remainder from its last tick */
+static void advanceTimer(const chip8 *chip8, uint8_t *value, long *cycles, uint64_t steps) {
+    uint64_t total, ticks;
+
+    if (!*value) return;
+
+    if (!chip8->timerHz) {
+        *value = steps < *value ? *value - steps : 0;
+        *cycles = 0;
+        return;
+    }
+
+    total = *cycles + steps * chip8->cycleTime;
+    ticks = total / chip8->timerMaxCycles;
+
+    if (ticks < *value) {
+        *value -= ticks;
+        *cycles = total - ticks * chip8->timerMaxCycles;
+    }
+    else {
+        *cycles += stepsToZero(chip8, *value, *cycles) * chip8->cycleTime - *value * chip8->timerMaxCycles;
+        *value = 0;
+    }
+}
+
+/* Catch the timers up with instrCount */
 void updateTimers(chip8 *chip8) {
+    uint64_t steps;
 
-    /* Delay timer */
-    if (chip8->delayTimer > 0) {
-        chip8->delayCycles += chip8->cycleTime;
+    if (chip8->instrCount <= chip8->timerInstr) return;
 
-        if (!chip8->timerHz || chip8->delayCycles >= chip8->timerMaxCycles) {
-            chip8->delayTimer--;
-            chip8->delayCycles = 0;
-        }
+    steps = chip8->instrCount - chip8->timerInstr;
+    advanceTimer(chip8, &chip8->delayTimer, &chip8->delayCycles, steps);
+    advanceTimer(chip8, &chip8->soundTimer, &chip8->soundCycles, steps);
+    chip8->timerInstr = chip8->instrCount;
+}
+
+/* Take the timer fields as they are, as of instrCount - after a reset, a
+ * state load or the host writing them. A beep still on with the sound
+ * timer at 0 is its last instruction. */
+void resyncTimers(chip8 *chip8) {
+    chip8->timerInstr = chip8->instrCount;
+
+    if (chip8->soundTimer) {
+        chip8->soundOff = chip8->instrCount + stepsToZero(chip8, chip8->soundTimer, chip8->soundCycles) + 1;
+    }
+    else {
+        chip8->soundOff = chip8->beep ? chip8->instrCount + 1 : 0;
+    }
+}
+
+/* Fx07 */
+static uint8_t readDelay(chip8 *chip8) {
+    updateTimers(chip8);
+    return chip8->delayTimer;
+}
+
+/* Fx15 */
+static void setDelay(chip8 *chip8, uint8_t value) {
+    updateTimers(chip8);
+    chip8->delayTimer = value;
+}
+
+/* Fx18 - beeps from this instruction through the one that ticks it to 0 */
+static void setSound(chip8 *chip8, uint8_t value) {
+    updateTimers(chip8);
+    chip8->soundTimer = value;
+    chip8->beep = value > 0;
+    resyncTimers(chip8);
+}
+
+/* All stores to RAM go through here so decoded instructions stay coherent */
+void writeRam(chip8 *chip8, uint16_t addr, uint8_t value) {
+#ifdef SUNCHIP_PAGED_RAM
+    uint8_t *page = writablePage(chip8, addr >> 8); /* Copies a shared page on first write */
+    if (!page) return;
+    page[addr & 0xFF] = value;
+#else
+    chip8->ram[addr] = value;
+#endif
+    markDirty(chip8, addr);
+
+    if (chip8->decodeCache) {
+        /* The byte is the high half of the opcode at addr or the low half at addr - 1 */
+        chip8->decodeCache[addr].handler = NULL;
+        chip8->decodeCache[(uint16_t)(addr - 1)].handler = NULL;
+    }
+
+    if (chip8->jit) {
+        jitInvalidate(chip8, addr);
     }
-    /* Sound timer */
-    if (chip8->soundTimer > 0) {
-        chip8->beep = true;
-        chip8->soundCycles += chip8->cycleTime;
+}
+
+/* Someone wrote length bytes at addr behind writeRam()'s back - drop the
+ * decoded and translated code covering them and mark the pages dirty */
+void ramChanged(chip8 *chip8, uint16_t addr, unsigned long length) {
+    unsigned long i;
+
+    for (i = 0; i < length; i++) {
+        const uint16_t a = addr + i;
 
-        if (!chip8->timerHz || chip8->soundCycles >= chip8->timerMaxCycles) {
-            chip8->soundTimer--;
-            chip8->soundCycles = 0;
+        if (chip8->decodeCache) {
+            chip8->decodeCache[a].handler = NULL;
+            chip8->decodeCache[(uint16_t)(a - 1)].handler = NULL;
+        }
+
+        /* Once per page is enough for the page based bookkeeping */
+        if (i == 0 || (a & (ramPageSize - 1)) == 0) {
+            markDirty(chip8, a);
+            if (chip8->jit) jitInvalidate(chip8, a);
         }
     }
-    else {
-        chip8->beep = false;
+}
+
+/* Bookkeeping shared by every engine after the instruction at addr */
+static void retire(chip8 *chip8, uint16_t addr, uint16_t opcode) {
+#ifdef SUNCHIP_TRACE
+    /* Trace records show the timers before the instruction's own time passes */
+    if (chip8->trace) {
+        updateTimers(chip8);
+    }
+#endif
+
+    chip8->instrCount++;
+
+#ifdef SUNCHIP_TRACE
+    if (chip8->trace) {
+        traceRecord(chip8, addr, opcode);
     }
+#endif
+
+#ifdef SUNCHIP_PROFILE
+    if (chip8->profile) {
+        chip8->profile->ops[profileKey(opcode)]++;
+        chip8->profile->pc[addr]++;
+    }
+#endif
+
+    (void)addr; (void)opcode;
+}
+
+/* XO-CHIP audio: the pattern lives at audioStartDefault so save states
+ * and rewind keep it, the synth hears about changes through audioPush() */
+static void loadPattern(chip8 *chip8) {
+    int i;
+    for (i = 0; i < audioSize; i++) {
+        writeRam(chip8, audioStartDefault + i, ramByte(chip8, chip8->I + i));
+    }
+    if (chip8->audio) audioPush(chip8);
+}
+
+static void setPitch(chip8 *chip8, uint8_t pitch) {
+    chip8->pitch = pitch;
+    if (chip8->audio) audioPush(chip8);
+}
+
+/* F000 NNNN: I takes the following word, which is then skipped */
+static void loadLongI(chip8 *chip8) {
+    chip8->I = (ramByte(chip8, chip8->PC) << 8) | ramByte(chip8, chip8->PC + 1);
+    chip8->PC += 2;
+}
+
+/* Per-instance xorshift32 - no shared rand() state between instances */
+static uint8_t nextRandom(chip8 *chip8) {
+    uint32_t r = chip8->rng;
+
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    chip8->rng = r;
+
+    return r >> 24;
 }
 
 /* Skip Instruction */
 void skipInstr(chip8 *chip8) {
-    if (chip8->ram[chip8->PC] == 0xF0 && chip8->ram[chip8->PC + 1 == 0x00]) {
+    /* F000 NNNN is four bytes long */
+    if (ramByte(chip8, chip8->PC) == 0xF0 && ramByte(chip8, chip8->PC + 1) == 0x00) {
         chip8->PC += 4;
     }
     else {
@@ -218,27 +600,92 @@ void skipInstr(chip8 *chip8) {
 /* Initialize CHIP-8 "emulator" */
 bool initEmu(chip8 *chip8, const char romFile[]) {
 
-    /* Set speeds */
+    /* Set speeds - 0 means "as fast as the host calls us" */
     setCpuSpeed(chip8, chip8->cpuHz);
+    setTimerSpeed(chip8, chip8->timerHz);
+    setRefreshSpeed(chip8, chip8->refreshHz);
+
+    /* Memory - a shared image is mapped (or copied) instead of loaded */
+    mapImage(chip8, chip8->image);
 
     /* Reset emulator */
     reset(chip8);
 
-    /* Load font */
-    loadFont(chip8);
+    /* Random numbers - seed 0 picks one from the clock */
+    if (!chip8->seed) {
+        chip8->seed = (uint32_t)time(NULL) ^ (uint32_t)clock() ^ (uint32_t)(size_t)chip8;
+    }
+    chip8->rng = chip8->seed ? chip8->seed : 1; /* xorshift can't leave 0 */
+
+    if (chip8->image) {
+        chip8->rom = romFile;
+    }
+    else {
+        /* Load font */
+        loadFont(chip8);
+
+        /* Load rom, from the pack if there is one - NULL leaves RAM to the host */
+        if (romFile && !(chip8->pack ? loadPackRom(chip8, chip8->pack, romFile) : loadRom(chip8, romFile))) {
+            return 0; /* false */
+        }
+    }
+
+    /* Decode cache - everything above was written behind its back */
+    if (!chip8->decodeCache) {
+        chip8->decodeCache = malloc(maxRam * sizeof *chip8->decodeCache);
+        if (!chip8->decodeCache) {
+            puts("Could not allocate decode cache");
+            return 0; /* false */
+        }
+    }
+    flushDecodeCache(chip8);
+
+    /* Quirks, and the interpreter variant built for them */
+    setPlatform(chip8, chip8->platform);
+
+    /* Nothing has been saved from the new machine yet */
+    memset(chip8->dirtyPages, 0xFF, sizeof chip8->dirtyPages);
+    chip8->stateSerial++;
 
-    /* Load rom */
-    loadRom(chip8, romFile);
+    /* Bring up the recompiler if it was asked for */
+    setEngine(chip8, chip8->engine);
 
     /* Emulate instructions */
     return 1; /* true */
 }
 
-/* Fetch and execute CHIP-8 instruction */
-void execute(chip8 *chip8) {
+/* Release what initEmu() allocated */
+void freeEmu(chip8 *chip8) {
+    free(chip8->decodeCache);
+    chip8->decodeCache = NULL;
+    freeJit(chip8);
+    freeTrace(chip8);
+    freeProfile(chip8);
+    freePages(chip8);
+    freeAudio(chip8);
+}
+
+/* Switch instruction engine, at start up or while running.
+ * Falls back to the cached engine if the recompiler isn't available. */
+bool setEngine(chip8 *chip8, EMUENGINE engine) {
+    chip8->engine = engine;
+
+    if (engine == engineJit && !initJit(chip8)) {
+        puts("Recompiler unavailable, using the cached interpreter");
+        chip8->engine = engineCached;
+        return 0; /* false */
+    }
+
+    return 1; /* true */
+}
+
+/* Fetch, decode and execute CHIP-8 instruction - reference interpreter */
+static void executeSwitch(chip8 *chip8) {
+    const uint16_t addr = chip8->PC;
+
     /* Fetch next opcode */
-    uint8_t b1 = chip8->ram[chip8->PC], /* NN = 8-bit constant */
-    b2 = chip8->ram[chip8->PC + 1]; /* NN */
+    uint8_t b1 = ramByte(chip8, chip8->PC), /* NN = 8-bit constant */
+    b2 = ramByte(chip8, chip8->PC + 1); /* NN */
 
     /* Instructions: */
     uint8_t c = b1 >> 4; /* Decode - first 8 bits of instruction */
@@ -260,17 +707,42 @@ void execute(chip8 *chip8) {
                     break;
 
                 case 0xE0: /* Clear the display - 00E0 */
-                    memset(&chip8->vram[0], false, sizeof chip8->vram);
+                    clearPlanes(chip8);
                     break;
 
                 case 0xEE: /* RET(urn) from address - 00EE */
-                    chip8->PC = (chip8->ram[chip8->SP] << 8);
-                    chip8->PC |= chip8->ram[chip8->SP + 1];
+                    chip8->PC = (ramByte(chip8, chip8->SP) << 8);
+                    chip8->PC |= ramByte(chip8, chip8->SP + 1);
                     chip8->SP -= 2;
                     break;
 
+                case 0xFB: /* Scroll right 4 pixels - 00FB: S-CHIP only */
+                    scrollHorizontal(chip8, true);
+                    break;
+
+                case 0xFC: /* Scroll left 4 pixels - 00FC: S-CHIP only */
+                    scrollHorizontal(chip8, false);
+                    break;
+
                 case 0xFD: /* EXIT - 00FD: S-CHIP only */
-                    quit = true;
+                    chip8->exit = true;
+                    break;
+
+                case 0xFE: /* Low-res 64x32 - 00FE: S-CHIP only */
+                    setHires(chip8, false);
+                    break;
+
+                case 0xFF: /* Hi-res 128x64 - 00FF: S-CHIP only */
+                    setHires(chip8, true);
+                    break;
+
+                default:
+                    if (y == 0x0C) { /* Scroll down N pixels - 00CN: S-CHIP only */
+                        scrollVertical(chip8, N);
+                    }
+                    else if (y == 0x0D) { /* Scroll up N pixels - 00DN: XO-CHIP only */
+                        scrollVertical(chip8, -N);
+                    }
                     break;
             }
             break;
@@ -281,8 +753,8 @@ void execute(chip8 *chip8) {
 
                 case 0x02: /* CALL address -  2NNN */
                     chip8->SP += 2;
-                    chip8->ram[chip8->SP] = chip8->PC >> 8;
-                    chip8->ram[chip8->SP + 1] = chip8->PC & 0x00FF;
+                    writeRam(chip8, chip8->SP, chip8->PC >> 8);
+                    writeRam(chip8, chip8->SP + 1, chip8->PC & 0x00FF);
                     chip8->PC = NNN;
                     break;
 
@@ -324,14 +796,17 @@ void execute(chip8 *chip8) {
 
                                 case 0x01: /* Set index register Vx to Vx or Vy - 8xy1 */
                                     chip8->V[x] |= chip8->V[y];
+                                    if (chip8->quirks[quirkVfReset]) chip8->V[0x0F] = 0;
                                     break;
 
                                 case 0x02: /* Set index register Vx and Vy - 8xy2 */
                                     chip8->V[x] &= chip8->V[y];
+                                    if (chip8->quirks[quirkVfReset]) chip8->V[0x0F] = 0;
                                     break;
 
                                 case 0x03: /* Set index register Vx xor Vy - 8xy3 */
                                     chip8->V[x] ^= chip8->V[y];
+                                    if (chip8->quirks[quirkVfReset]) chip8->V[0x0F] = 0;
                                     break;
 
                                 case 0x04: { /* Adds index register Vx from Vy and sets VF to 1 if carry - 8xy4 */
@@ -349,7 +824,9 @@ void execute(chip8 *chip8) {
                                 }
 
                                 case 0x06: { /* Set index register Vx xor Vy - 8xy6 */
-                                    int carry = chip8->V[x] & 0x01;
+                                    int carry;
+                                    if (chip8->quirks[quirkShiftVy]) chip8->V[x] = chip8->V[y];
+                                    carry = chip8->V[x] & 0x01;
                                     chip8->V[x] >>= 1;
                                     chip8->V[0x0F] = carry;
                                     break;
@@ -363,7 +840,9 @@ void execute(chip8 *chip8) {
                                 }
 
                                 case 0x0E: { /* Subtracts index register Vx from Vy - 8xyE */
-                                    int carry = (chip8->V[x] & 0x80) >> 7;
+                                    int carry;
+                                    if (chip8->quirks[quirkShiftVy]) chip8->V[x] = chip8->V[y];
+                                    carry = (chip8->V[x] & 0x80) >> 7;
                                     chip8->V[x] <<= 1;
                                     chip8->V[0x0F] = carry;
                                     break;
@@ -383,27 +862,27 @@ void execute(chip8 *chip8) {
                                     break;
 
                                 case 0x0B: /* C8: J(um)P to address NNN + V0, SC: Jump to address NNN + Vx - BNNN */
-                                    chip8->PC = NNN + chip8->V[0];
+                                    chip8->PC = NNN + chip8->V[chip8->quirks[quirkJumpVx] ? x : 0];
                                     break;
 
                                 case 0x0C: /* Set Vx to random byte and NN - CxNN  */
-                                    chip8->V[x] = (rand() % 0x1000) & NN;
+                                    chip8->V[x] = nextRandom(chip8) & NN;
                                     break;
 
                                 case 0x0D: /* Display N-byte sprite at coordinates (Vx, Vy), set VF = collision - DxyN */
-                                    draw(chip8, chip8->V[x] % displayWidth, chip8->V[y] % displayHeight, N);
+                                    draw(chip8, chip8->V[x] % screenWidth(chip8), chip8->V[y] % screenHeight(chip8), N);
                                     break;
 
                                 case 0x0E:
                                     switch (b2) {
                                         case 0x9E: /* If key Vx is pressed, skip the next instruction - Ex9E */
-                                            if (chip8->keypad[chip8->V[x]] == keyDown) {
+                                            if (chip8->keypad[chip8->V[x] & 0xF] == keyDown) {
                                                 skipInstr(chip8);
                                             }
                                             break;
 
                                         case 0xA1: /* If key Vx is not pressed, skip the next instruction - ExA1 */
-                                            if (chip8->keypad[chip8->V[x]] == keyUp) {
+                                            if (chip8->keypad[chip8->V[x] & 0xF] != keyDown) {
                                                 skipInstr(chip8);
                                             }
                                             break;
@@ -412,8 +891,22 @@ void execute(chip8 *chip8) {
 
                                         case 0x0F:
                                             switch (b2) {
+                                                case 0x00: /* L(oa)D I = NNNN, the next word - F000 NNNN: XO-CHIP only */
+                                                    if (x == 0) {
+                                                        loadLongI(chip8);
+                                                    }
+                                                    break;
+
+                                                case 0x01: /* Select planes x for drawing, clearing and scrolling - Fx01: XO-CHIP only */
+                                                    chip8->bitMask = (EMUBM)(x & bmBoth);
+                                                    break;
+
+                                                case 0x02: /* Load 16 byte audio pattern from I - F002: XO-CHIP only */
+                                                    loadPattern(chip8);
+                                                    break;
+
                                                 case 0x07: /* L(oa)D Vx = delay timer - Fx07 */
-                                                    chip8->V[x] = chip8->delayTimer;
+                                                    chip8->V[x] = readDelay(chip8);
                                                     break;
 
                                                 case 0x0A: /* Wait for key to be pressed, L(oa)D Vx = key value - Fx0A */
@@ -421,11 +914,11 @@ void execute(chip8 *chip8) {
                                                     break;
 
                                                 case 0x15: /* L(oa)D delay timer = Vx - Fx15  */
-                                                    chip8->delayTimer = chip8->V[x];
+                                                    setDelay(chip8, chip8->V[x]);
                                                     break;
 
                                                 case 0x18: /* L(oa)D sound timer = Vx - Fx18 */
-                                                    chip8->soundTimer = chip8->V[x];
+                                                    setSound(chip8, chip8->V[x]);
                                                     break;
 
                                                 case 0x1E: /* ADD Vx to I - Fx1E */
@@ -436,29 +929,35 @@ void execute(chip8 *chip8) {
                                                     chip8->I = chip8->V[x] * 0x05;
                                                     break;
 
-                                                case 0x30:
-                                                    chip8->I = bigFontStartDefault + (chip8->V[x] * 0x05);
+                                                case 0x30: /* L(oa)D big font digit Vx - Fx30: S-CHIP only */
+                                                    chip8->I = bigFontStartDefault + (chip8->V[x] * 10);
+                                                    break;
+
+                                                case 0x3A: /* Set audio pitch to Vx - Fx3A: XO-CHIP only */
+                                                    setPitch(chip8, chip8->V[x]);
                                                     break;
 
                                                 case 0x33: /* Store Vx in locations I, I + 1, and I + 2 - Fx33 */
-                                                    chip8->ram[chip8->I]     = (chip8->V[x] / 100) % 10;
-                                                    chip8->ram[chip8->I + 1] = (chip8->V[x] / 10) % 10;
-                                                    chip8->ram[chip8->I + 2] =  chip8->V[x] % 10;
+                                                    writeRam(chip8, chip8->I,     (chip8->V[x] / 100) % 10);
+                                                    writeRam(chip8, chip8->I + 1, (chip8->V[x] / 10) % 10);
+                                                    writeRam(chip8, chip8->I + 2,  chip8->V[x] % 10);
                                                     break;
 
                                                 case 0x55: { /* Store registers V0 through Vx in memory starting at location I - Fx55 */
                                                     int r;
                                                     for (r = 0; r <=x; r++) {
-                                                        chip8->ram[chip8->I + r] = chip8->V[r];
+                                                        writeRam(chip8, chip8->I + r, chip8->V[r]);
                                                     }
+                                                    if (chip8->quirks[quirkLoadStoreI]) chip8->I += x + 1;
                                                     break;
                                                 }
 
                                                 case 0x65: { /* Read registers V0 through Vx from memory starting at location I - Fx65 */
                                                     int r;
                                                     for (r = 0; r <=x; r++) {
-                                                        chip8->V[r] = chip8->ram[chip8->I + r];
+                                                        chip8->V[r] = ramByte(chip8, chip8->I + r);
                                                     }
+                                                    if (chip8->quirks[quirkLoadStoreI]) chip8->I += x + 1;
                                                     break;
                                                 }
                                             }
@@ -470,17 +969,321 @@ void execute(chip8 *chip8) {
                                                     puts(""); /* Prevent duplicate printing */
                                                     break;
     }
-    resetKeypad(chip8);     /* Reset keys that were released in the previous frame */
-    printf ("PC->%x", chip8->PC);
-    printf(" Opcode: 0x%02X", b1);
-    fflush(stdout);
-    printf(" 0x%02X", b2);
-    printf (" - SP->%x", chip8->SP);
-    printf (" I->%x", chip8->I);
-    printf (" Delay timer: %x\n", chip8->delayTimer);
+    retire(chip8, addr, (b1 << 8) | b2);
+}
+
+/* Pre-decoded instruction handlers - one per opcode, PC already advanced */
+static void opHalt(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    chip8->PC -= 2;
+}
+
+static void opCls(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    clearPlanes(chip8);
+}
+
+static void opRet(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    chip8->PC = (ramByte(chip8, chip8->SP) << 8);
+    chip8->PC |= ramByte(chip8, chip8->SP + 1);
+    chip8->SP -= 2;
+}
+
+static void opExit(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    chip8->exit = true;
+}
+
+static void opScrollDown(chip8 *chip8, const emuDecoded *op) {
+    scrollVertical(chip8, op->N);
+}
+
+static void opScrollUp(chip8 *chip8, const emuDecoded *op) {
+    scrollVertical(chip8, -op->N);
+}
+
+static void opScrollRight(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    scrollHorizontal(chip8, true);
+}
+
+static void opScrollLeft(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    scrollHorizontal(chip8, false);
+}
+
+static void opLores(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    setHires(chip8, false);
+}
+
+static void opHires(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    setHires(chip8, true);
+}
+
+static void opNop(chip8 *chip8, const emuDecoded *op) {
+    (void)chip8; (void)op;
+}
+
+static void opJp(chip8 *chip8, const emuDecoded *op) {
+    chip8->PC = op->NNN;
+}
+
+static void opCall(chip8 *chip8, const emuDecoded *op) {
+    chip8->SP += 2;
+    writeRam(chip8, chip8->SP, chip8->PC >> 8);
+    writeRam(chip8, chip8->SP + 1, chip8->PC & 0x00FF);
+    chip8->PC = op->NNN;
+}
+
+static void opSeImm(chip8 *chip8, const emuDecoded *op) {
+    if (chip8->V[op->x] == op->NN) skipInstr(chip8);
+}
+
+static void opSneImm(chip8 *chip8, const emuDecoded *op) {
+    if (chip8->V[op->x] != op->NN) skipInstr(chip8);
+}
+
+static void opSeReg(chip8 *chip8, const emuDecoded *op) {
+    if (chip8->V[op->x] == chip8->V[op->y]) skipInstr(chip8);
+}
+
+static void opSneReg(chip8 *chip8, const emuDecoded *op) {
+    if (chip8->V[op->x] != chip8->V[op->y]) skipInstr(chip8);
+}
+
+static void opLdImm(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] = op->NN;
+}
+
+static void opAddImm(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] += op->NN;
+}
+
+static void opLdReg(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] = chip8->V[op->y];
+}
+
+static void opAddReg(chip8 *chip8, const emuDecoded *op) {
+    bool carry = ((chip8->V[op->x] + chip8->V[op->y]) > 0xFF);
+    chip8->V[op->x] += chip8->V[op->y];
+    chip8->V[0x0F] = carry;
+}
+
+static void opSub(chip8 *chip8, const emuDecoded *op) {
+    bool noBorrow = (chip8->V[op->x] >= chip8->V[op->y]);
+    chip8->V[op->x] = chip8->V[op->x] - chip8->V[op->y];
+    chip8->V[0x0F] = noBorrow;
+}
+
+static void opSubn(chip8 *chip8, const emuDecoded *op) {
+    bool noBorrow = (chip8->V[op->y] >= chip8->V[op->x]);
+    chip8->V[op->x] = chip8->V[op->y] - chip8->V[op->x];
+    chip8->V[0x0F] = noBorrow;
+}
+
+static void opLdI(chip8 *chip8, const emuDecoded *op) {
+    chip8->I = op->NNN;
+}
+
+static void opRnd(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] = nextRandom(chip8) & op->NN;
+}
+
+static void opSkp(chip8 *chip8, const emuDecoded *op) {
+    if (chip8->keypad[chip8->V[op->x] & 0xF] == keyDown) skipInstr(chip8);
+}
+
+static void opSknp(chip8 *chip8, const emuDecoded *op) {
+    if (chip8->keypad[chip8->V[op->x] & 0xF] != keyDown) skipInstr(chip8);
+}
+
+static void opLdVxDt(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] = readDelay(chip8);
+}
+
+static void opLdKey(chip8 *chip8, const emuDecoded *op) {
+    keyWait(chip8, op->x);
+}
+
+static void opLdDt(chip8 *chip8, const emuDecoded *op) {
+    setDelay(chip8, chip8->V[op->x]);
+}
+
+static void opLdSt(chip8 *chip8, const emuDecoded *op) {
+    setSound(chip8, chip8->V[op->x]);
+}
+
+static void opAddI(chip8 *chip8, const emuDecoded *op) {
+    chip8->I += chip8->V[op->x];
+}
+
+static void opLdILong(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    loadLongI(chip8);
+}
+
+static void opPlane(chip8 *chip8, const emuDecoded *op) {
+    chip8->bitMask = (EMUBM)(op->x & bmBoth);
+}
+
+static void opPattern(chip8 *chip8, const emuDecoded *op) {
+    (void)op;
+    loadPattern(chip8);
+}
+
+static void opPitch(chip8 *chip8, const emuDecoded *op) {
+    setPitch(chip8, chip8->V[op->x]);
+}
+
+static void opLdFont(chip8 *chip8, const emuDecoded *op) {
+    chip8->I = chip8->V[op->x] * 0x05;
+}
+
+static void opLdBigFont(chip8 *chip8, const emuDecoded *op) {
+    chip8->I = bigFontStartDefault + (chip8->V[op->x] * 10);
+}
+
+static void opBcd(chip8 *chip8, const emuDecoded *op) {
+    writeRam(chip8, chip8->I,     (chip8->V[op->x] / 100) % 10);
+    writeRam(chip8, chip8->I + 1, (chip8->V[op->x] / 10) % 10);
+    writeRam(chip8, chip8->I + 2,  chip8->V[op->x] % 10);
+}
+
+/* Decode the instruction at addr into op - mirrors executeSwitch() */
+static void decode(const chip8 *chip8, uint16_t addr, emuDecoded *op) {
+    const uint8_t b1 = ramByte(chip8, addr);
+    const uint8_t b2 = ramByte(chip8, addr + 1);
+
+    op->opcode = (b1 << 8) | b2;
+    op->NNN = ((b1 & 0xF) << 8) | b2;
+    op->N = b2 & 0xF;
+    op->x = b1 & 0xF;
+    op->y = b2 >> 4;
+    op->NN = b2;
+    op->handler = opNop;
+
+    switch (b1 >> 4) {
+        case 0x00:
+            switch (b2) {
+                case 0x00: op->handler = opHalt; break;
+                case 0xE0: op->handler = opCls; break;
+                case 0xEE: op->handler = opRet; break;
+                case 0xFB: op->handler = opScrollRight; break;
+                case 0xFC: op->handler = opScrollLeft; break;
+                case 0xFD: op->handler = opExit; break;
+                case 0xFE: op->handler = opLores; break;
+                case 0xFF: op->handler = opHires; break;
+                default:
+                    if (op->y == 0x0C) op->handler = opScrollDown;
+                    else if (op->y == 0x0D) op->handler = opScrollUp;
+                    break;
+            }
+            break;
+
+        case 0x01: op->handler = opJp; break;
+        case 0x02: op->handler = opCall; break;
+        case 0x03: op->handler = opSeImm; break;
+        case 0x04: op->handler = opSneImm; break;
+        case 0x05: if (op->N == 0x00) op->handler = opSeReg; break;
+        case 0x06: op->handler = opLdImm; break;
+        case 0x07: op->handler = opAddImm; break;
+
+        case 0x08:
+            switch (op->N) {
+                case 0x00: op->handler = opLdReg; break;
+                case 0x01: op->handler = chip8->quirkOps->orReg; break;
+                case 0x02: op->handler = chip8->quirkOps->andReg; break;
+                case 0x03: op->handler = chip8->quirkOps->xorReg; break;
+                case 0x04: op->handler = opAddReg; break;
+                case 0x05: op->handler = opSub; break;
+                case 0x06: op->handler = chip8->quirkOps->shr; break;
+                case 0x07: op->handler = opSubn; break;
+                case 0x0E: op->handler = chip8->quirkOps->shl; break;
+            }
+            break;
+
+        case 0x09: op->handler = opSneReg; break;
+        case 0x0A: op->handler = opLdI; break;
+        case 0x0B: op->handler = chip8->quirkOps->jumpV0; break;
+        case 0x0C: op->handler = opRnd; break;
+        case 0x0D: op->handler = chip8->quirkOps->drw; break;
+
+        case 0x0E:
+            switch (b2) {
+                case 0x9E: op->handler = opSkp; break;
+                case 0xA1: op->handler = opSknp; break;
+            }
+            break;
+
+        case 0x0F:
+            switch (b2) {
+                case 0x00: if (op->x == 0) op->handler = opLdILong; break;
+                case 0x01: op->handler = opPlane; break;
+                case 0x02: if (op->x == 0) op->handler = opPattern; break;
+                case 0x07: op->handler = opLdVxDt; break;
+                case 0x0A: op->handler = opLdKey; break;
+                case 0x15: op->handler = opLdDt; break;
+                case 0x18: op->handler = opLdSt; break;
+                case 0x1E: op->handler = opAddI; break;
+                case 0x29: op->handler = opLdFont; break;
+                case 0x30: op->handler = opLdBigFont; break;
+                case 0x33: op->handler = opBcd; break;
+                case 0x3A: op->handler = opPitch; break;
+                case 0x55: op->handler = chip8->quirkOps->store; break;
+                case 0x65: op->handler = chip8->quirkOps->load; break;
+            }
+            break;
+    }
+
+    /* The only places skipIdle() has anything to find */
+    op->idle = op->opcode == 0x0000 || op->opcode == (0x1000 | addr) ||
+               (op->opcode & 0xF0FF) == 0xF00A || (op->opcode & 0xF0FF) == 0xF007;
+}
+
+/* Drop every decoded instruction - call after writing ram[] directly */
+void flushDecodeCache(chip8 *chip8) {
+    if (chip8->decodeCache) {
+        memset(chip8->decodeCache, 0, maxRam * sizeof *chip8->decodeCache);
+    }
+    jitFlush(chip8);
 }
 
-/* CPU cycle */
+/* The cached instruction at PC, decoding it on first use */
+static const emuDecoded *decodedAt(chip8 *chip8) {
+    emuDecoded *op = &chip8->decodeCache[chip8->PC];
+
+    if (!op->handler) {
+        decode(chip8, chip8->PC, op);
+    }
+    return op;
+}
+
+/* Execute the cached instruction at PC */
+static void executeCached(chip8 *chip8) {
+    const uint16_t addr = chip8->PC;
+    const emuDecoded *op = decodedAt(chip8);
+
+    chip8->PC += 2; /* Move PC to next opcode */
+    op->handler(chip8, op);
+
+    retire(chip8, addr, op->opcode);
+}
+
+/* Execute one instruction with the selected engine - the recompiler
+ * hands anything it didn't translate to the cached interpreter */
+void execute(chip8 *chip8) {
+    if (chip8->engine != engineSwitch && chip8->decodeCache) {
+        executeCached(chip8);
+    }
+    else {
+        executeSwitch(chip8);
+    }
+}
+
+/* CPU cycle - timers count retired instructions, see updateTimers() */
 bool cycle(chip8 *chip8) {
     bool executed = false;
     /* update time */
@@ -493,6 +1296,184 @@ bool cycle(chip8 *chip8) {
         executed = true;
     }
 
+    return executed;
+}
+
+/* Spot loops that can't change anything but the delay timer before the
+ * next frame: 0000, a 1NNN to itself, Fx0A with no key released, and
+ * Fx07 / 3x00 / 1NNN delay timer spins. Retire up to budget of their
+ * instructions at once with the same end state as running them.
+ * Returns the number skipped, 0 to run normally. Only called for op at
+ * PC when decode() flagged it idle. */
+static unsigned long skipIdle(chip8 *chip8, const emuDecoded *op, unsigned long budget) {
+    const uint16_t pc = chip8->PC;
+    const uint16_t opcode = op->opcode;
+    unsigned long skip = 0;
+
+    /* A beep turning off has to be seen at its own instruction */
+    if (chip8->beep) return 0;
+
+    if (opcode == 0x0000 || opcode == (0x1000 | pc)) {
+        /* Halt, or jump to self */
+        skip = budget;
+    }
+    else if ((opcode & 0xF0FF) == 0xF00A) {
+        /* Input only changes between runInstructions() calls */
+        int k;
+        for (k = 0; k < defaultKeys; k++) {
+            if (chip8->keypad[k] == keyReleased) return 0;
+        }
+        skip = budget;
+    }
+    else if ((opcode & 0xF0FF) == 0xF007 && readDelay(chip8) > 0 &&
+             ((ramByte(chip8, pc + 2) << 8) | ramByte(chip8, pc + 3)) == (0x3000 | (opcode & 0x0F00)) &&
+             ((ramByte(chip8, pc + 4) << 8) | ramByte(chip8, pc + 5)) == (0x1000 | pc)) {
+        /* Whole passes round the loop that still read a non-zero timer */
+        const uint64_t passes = (stepsToZero(chip8, chip8->delayTimer, chip8->delayCycles) + 2) / 3;
+        const unsigned long fit = budget / 3;
+        const unsigned long n = passes < fit ? passes : fit;
+        uint8_t value = chip8->delayTimer;
+        long cycles = chip8->delayCycles;
+
+        if (!n) return 0;
+
+        /* Vx holds what the last pass read, the timer itself is lazy */
+        advanceTimer(chip8, &value, &cycles, (n - 1) * 3);
+        chip8->V[(opcode >> 8) & 0xF] = value;
+        chip8->instrCount += n * 3;
+        chip8->cpuCycles = 0;
+        return n * 3;
+    }
+
+    if (!skip) return 0;
+
+    chip8->instrCount += skip;
+    chip8->cpuCycles = 0;
+    return skip;
+}
+
+/* Run up to count instructions back to back, at emulated (not real) time.
+ * Returns the number of instructions executed, which is less than count
+ * only if the ROM exited. Idle loops are fast-forwarded by the cached and
+ * recompiling engines, at the instructions and block exits decode()
+ * flagged; engineSwitch runs every instruction as the reference. */
+unsigned long runInstructions(chip8 *chip8, unsigned long count) {
+    const bool fast = chip8->engine != engineSwitch && chip8->decodeCache && !traceActive(chip8) && !profileActive(chip8);
+    unsigned long executed = 0;
+#ifdef SUNCHIP_PROFILE
+    const uint64_t start = chip8->profile ? profileNanos() : 0;
+#endif
+
+    if (chip8->paused) return 0;
+
+    /* Every call to cycle() is one instruction worth of emulated time */
+    setCycleTime(chip8, chip8->cpuHz ? chip8->cpuMaxCycles : earthSecond / defaultSpeed);
+
+    while (executed < count && !chip8->exit) {
+        const bool beep = chip8->beep;
+        const emuDecoded *op = fast && !chip8->noIdleSkip ? decodedAt(chip8) : NULL;
+        unsigned long ran;
+
+        if (op && op->idle && (ran = skipIdle(chip8, op, count - executed)) > 0) {
+            /* Idle loop fast-forwarded */
+        }
+        else if (fast && chip8->engine == engineJit && (ran = jitRun(chip8, count - executed)) > 0) {
+            /* Block boundary - the timers catch up when next looked at */
+            chip8->cpuCycles = 0;
+            chip8->instrCount += ran;
+        }
+        else {
+            cycle(chip8);
+            ran = 1;
+        }
+        executed += ran;
+
+        if (chip8->beep && chip8->instrCount >= chip8->soundOff) {
+            chip8->beep = false;
+        }
+
+        if (chip8->beep != beep) {
+            if (chip8->audio) audioPush(chip8);
+            if (chip8->callbacks.audio) chip8->callbacks.audio(chip8->callbacks.userData, chip8->beep);
+        }
+    }
+
+    /* Timer fields are current between calls */
     updateTimers(chip8);
+
+#ifdef SUNCHIP_PROFILE
+    if (chip8->profile) {
+        chip8->profile->runNanos += profileNanos() - start;
+    }
+#endif
+
+    return executed;
+}
+
+/* Instructions of this frame that run before key lands - the first
+ * instruction starting at or after its offset, which is measured from the
+ * frame boundary refreshCycles is counted from */
+static unsigned long keyInstruction(const chip8 *chip8, const emuKeyEvent *key, long cycleTime, unsigned long budget) {
+    unsigned long at;
+
+    if ((long)key->offset <= chip8->refreshCycles) return 0;
+
+    at = (key->offset - chip8->refreshCycles + cycleTime - 1) / cycleTime;
+    return at < budget ? at : budget;
+}
+
+/* Run one frame worth of instructions (cpuHz / refreshHz), taking input
+ * before and presenting video after. Queued key events split the frame
+ * so each lands on its own instruction boundary. */
+unsigned long runFrame(chip8 *chip8) {
+    const long frameTime = chip8->refreshHz ? chip8->refreshMaxCycles : earthSecond / defaultRefreshHz;
+    const long cycleTime = chip8->cpuHz ? chip8->cpuMaxCycles : earthSecond / defaultSpeed;
+    emuKeyEvent keys[keyQueueSize];
+    unsigned long executed = 0, budget = 0;
+    unsigned count, k;
+
+    if (chip8->callbacks.input) {
+        chip8->callbacks.input(chip8->callbacks.userData, chip8);
+    }
+    count = takeKeys(chip8, keys);
+    if (chip8->inputLog) {
+        count = inputFrame(chip8, keys, count);
+    }
+
+    if (chip8->refreshCycles < frameTime) {
+        /* Instructions left until the frame boundary, rounded up */
+        budget = (frameTime - chip8->refreshCycles + cycleTime - 1) / cycleTime;
+    }
+
+    for (k = 0; k < count; k++) {
+        const unsigned long at = keyInstruction(chip8, &keys[k], cycleTime, budget);
+
+        if (at > executed) {
+            executed += runInstructions(chip8, at - executed);
+        }
+        chip8->keypad[keys[k].key & 0xF] = (EMUKEYS)keys[k].state;
+    }
+
+    if (executed < budget) {
+        executed += runInstructions(chip8, budget - executed);
+    }
+    chip8->refreshCycles += executed * cycleTime;
+
+    /* Carry the remainder over so frames average out to exactly refreshHz */
+    if (chip8->refreshCycles >= frameTime) {
+        chip8->refreshCycles -= frameTime;
+    }
+
+    /* A release Fx0A didn't take is over with its frame */
+    resetReleased(chip8);
+
+    if (chip8->inputLog) {
+        inputEndFrame(chip8);
+    }
+
+    if (chip8->callbacks.video) {
+        chip8->callbacks.video(chip8->callbacks.userData, chip8);
+    }
+
     return executed;
 }
@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Key event queue and input logs for deterministic replay
+ *
+ * The host queues key changes stamped with how far into its frame they
+ * happened; runFrame() takes them all at once and applies each at the
+ * instruction boundary that stamp maps to in the next emulated frame.
+ * The queue is single producer, single consumer, so the host may fill it
+ * from another thread than the one emulating.
+ *
+ * A log is the PRNG seed, speeds and quirk preset a run started with,
+ * followed by every keypad change the host made, stamped with the
+ * runFrame() it was seen in. Replaying it on the same ROM reproduces the
+ * run exactly (quirks set by hand under platformCustom aren't recorded).
+ * All values are little-endian:
+ *
+ *     "SCIN" version:2 platform:1 reserved:1 seed:4 cpuHz:4 timerHz:4 refreshHz:4
+ *     frame:4 key:1 state:1 offset:2      (repeated, offset in microseconds)
+ *     frame:4 0xFF 0 0 0                   (end, frame = frames run)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+#define inputEnd 0xFF /* Key value of the end record */
+
+struct emuInput {
+    FILE *file;
+    bool replay;
+    uint32_t frame; /* runFrame() calls so far */
+    EMUKEYS last[defaultKeys]; /* Keypad as the previous frame left it */
+
+    /* Replay */
+    uint8_t next[8]; /* Next record to queue, when pending */
+    bool pending;
+    bool ended; /* End record (or end of file) seen */
+    uint32_t endFrame; /* Frames in the log, once ended */
+};
+
+static void put32(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = value >> 24;
+}
+
+static void put16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static uint32_t get32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static emuInput *attach(chip8 *chip8, FILE *file, bool replay) {
+    emuInput *input;
+
+    stopInput(chip8);
+
+    input = calloc(1, sizeof *input);
+    if (!input) return NULL;
+
+    input->file = file;
+    input->replay = replay;
+    memcpy(input->last, chip8->keypad, sizeof input->last);
+    chip8->inputLog = input;
+    return input;
+}
+
+/* Start logging keypad changes to file - call after initEmu() so the seed
+ * is settled. The file stays the caller's. */
+bool recordInput(chip8 *chip8, FILE *file) {
+    uint8_t header[24];
+
+    memcpy(header, inputMagic, 4);
+    header[4] = inputVersion & 0xFF;
+    header[5] = inputVersion >> 8;
+    header[6] = chip8->platform;
+    header[7] = 0;
+    put32(&header[8], chip8->seed);
+    put32(&header[12], chip8->cpuHz);
+    put32(&header[16], chip8->timerHz);
+    put32(&header[20], chip8->refreshHz);
+
+    if (fwrite(header, sizeof header, 1, file) != 1) return 0; /* false */
+    return attach(chip8, file, false) != NULL;
+}
+
+/* Read the next replay record - a truncated log ends with the current frame */
+static void readNext(emuInput *input) {
+    input->pending = false;
+
+    if (fread(input->next, sizeof input->next, 1, input->file) != 1) {
+        input->ended = true;
+        input->endFrame = input->frame + 1;
+    }
+    else if (input->next[4] == inputEnd) {
+        input->ended = true;
+        input->endFrame = get32(input->next);
+    }
+    else {
+        input->pending = true;
+    }
+}
+
+/* Drive chip8's keypad from a log - call before initEmu(), which picks up
+ * the seed, speeds and preset read from the header */
+bool replayInput(chip8 *chip8, FILE *file) {
+    uint8_t header[24];
+    emuInput *input;
+
+    if (fread(header, sizeof header, 1, file) != 1 || memcmp(header, inputMagic, 4) ||
+        (header[4] | (header[5] << 8)) != inputVersion) {
+        return 0; /* false */
+    }
+
+    chip8->platform = (EMUPLATFORM)(header[6] <= platformXoChip ? header[6] : platformCustom);
+    chip8->seed = get32(&header[8]);
+    chip8->cpuHz = get32(&header[12]);
+    chip8->timerHz = get32(&header[16]);
+    chip8->refreshHz = get32(&header[20]);
+
+    input = attach(chip8, file, true);
+    if (!input) return 0; /* false */
+
+    readNext(input);
+    return 1; /* true */
+}
+
+/* End recording (writing the end record) or replaying */
+void stopInput(chip8 *chip8) {
+    emuInput *input = chip8->inputLog;
+
+    if (!input) return;
+
+    if (!input->replay) {
+        uint8_t record[8] = {0};
+        put32(record, input->frame);
+        record[4] = inputEnd;
+        fwrite(record, sizeof record, 1, input->file);
+        fflush(input->file);
+    }
+
+    free(input);
+    chip8->inputLog = NULL;
+}
+
+/* True once a replay has run every frame in its log */
+bool inputDone(const chip8 *chip8) {
+    const emuInput *input = chip8->inputLog;
+    return input && input->replay && input->ended && input->frame >= input->endFrame;
+}
+
+static void writeKey(emuInput *input, const emuKeyEvent *key) {
+    uint8_t record[8];
+
+    put32(record, input->frame);
+    record[4] = key->key;
+    record[5] = key->state;
+    put16(&record[6], key->offset > 0xFFFF ? 0xFFFF : key->offset);
+    fwrite(record, sizeof record, 1, input->file);
+}
+
+/* Start of runFrame(), with the events takeKeys() returned: log them and
+ * whatever the host's input callback changed directly, or swap them for
+ * what the log says happened. Returns the number of events in keys. */
+unsigned inputFrame(chip8 *chip8, emuKeyEvent *keys, unsigned count) {
+    emuInput *input = chip8->inputLog;
+    unsigned i;
+    int k;
+
+    if (input->replay) {
+        count = 0;
+        while (input->pending && get32(input->next) == input->frame && count < keyQueueSize) {
+            keys[count].key = input->next[4] & 0xF;
+            keys[count].state = input->next[5];
+            keys[count].offset = input->next[6] | (input->next[7] << 8);
+            count++;
+            readNext(input);
+        }
+        return count;
+    }
+
+    /* Callback changes are already in the keypad, they replay at offset 0 */
+    for (k = 0; k < defaultKeys; k++) {
+        if (chip8->keypad[k] != input->last[k]) {
+            emuKeyEvent key;
+            key.offset = 0;
+            key.key = k;
+            key.state = chip8->keypad[k];
+            writeKey(input, &key);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        writeKey(input, &keys[i]);
+    }
+    return count;
+}
+
+/* End of runFrame() */
+void inputEndFrame(chip8 *chip8) {
+    emuInput *input = chip8->inputLog;
+
+    memcpy(input->last, chip8->keypad, sizeof input->last);
+    input->frame++;
+}
+
+/* Queue a key change that happened offset microseconds into the host's
+ * current frame - it is applied that far into the next emulated frame.
+ * Host side of the queue. False if a frame's worth of events is already
+ * waiting. */
+bool queueKey(chip8 *chip8, uint8_t key, bool down, uint32_t offset) {
+    const unsigned long head = chip8->keyHead;
+    emuKeyEvent *event = &chip8->keyQueue[head & (keyQueueSize - 1)];
+
+    if (head - __atomic_load_n(&chip8->keyTail, __ATOMIC_ACQUIRE) >= keyQueueSize) return 0; /* false */
+
+    event->offset = offset;
+    event->key = key & 0xF;
+    event->state = down ? keyDown : keyReleased;
+
+    /* Event contents must be visible before the new head */
+    __atomic_store_n(&chip8->keyHead, head + 1, __ATOMIC_RELEASE);
+    return 1; /* true */
+}
+
+/* Move every queued event into keys (keyQueueSize entries) in the order
+ * queued - emulation side, called by runFrame() */
+unsigned takeKeys(chip8 *chip8, emuKeyEvent *keys) {
+    const unsigned long head = __atomic_load_n(&chip8->keyHead, __ATOMIC_ACQUIRE);
+    unsigned long tail = chip8->keyTail;
+    unsigned count = 0;
+
+    while (tail != head) {
+        keys[count++] = chip8->keyQueue[tail++ & (keyQueueSize - 1)];
+    }
+
+    __atomic_store_n(&chip8->keyTail, tail, __ATOMIC_RELEASE);
+    return count;
+}
@@ -0,0 +1,372 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * x86-64 dynamic recompiler
+ *
+ * Straight-line runs of register/index instructions (6xNN, 7xNN, 8xyN,
+ * ANNN, Fx1E) are translated into native code, optionally ending with the
+ * 1NNN that closes the block. Everything else - skips, calls, returns,
+ * BNNN, draws, timers, keys and memory stores - ends the block and runs
+ * through execute(), so timers and keyWait() are serviced exactly as the
+ * interpreter does at every block boundary.
+ */
+
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define jitCodeSize (1 << 20) /* Translated code buffer */
+#define jitMaxBlock 64 /* Instructions per block */
+#define jitMaxBlockBytes 2304 /* Upper bound on native bytes per block (25 per instruction) */
+#define jitNone 0xFFFFFFFF /* Address can't start a block */
+#define jitPages (maxRam >> 8)
+
+typedef void (*jitFn)(chip8 *chip8);
+
+struct emuJit {
+    uint8_t *code; /* RWX buffer */
+    size_t used;
+    uint32_t block[maxRam]; /* Code offset + 1 per start address, 0 = not translated */
+    uint8_t length[maxRam]; /* Instructions in block */
+    bool pageCode[jitPages]; /* Page holds translated instructions */
+};
+
+/* Emit helpers - rbx holds the chip8 pointer for the whole block */
+static uint8_t *emit8(uint8_t *p, uint8_t b) {
+    *p++ = b;
+    return p;
+}
+
+static uint8_t *emit16(uint8_t *p, uint16_t w) {
+    p = emit8(p, w & 0xFF);
+    return emit8(p, w >> 8);
+}
+
+static uint8_t *emit32(uint8_t *p, uint32_t d) {
+    p = emit16(p, d & 0xFFFF);
+    return emit16(p, d >> 16);
+}
+
+/* <opcode...> modrm [rbx + disp32] */
+static uint8_t *emitRbx(uint8_t *p, uint8_t modrmReg, size_t disp) {
+    p = emit8(p, 0x83 | (modrmReg << 3));
+    return emit32(p, (uint32_t)disp);
+}
+
+#define offV(r) (offsetof(struct chip8, V) + (r))
+#define offI offsetof(struct chip8, I)
+#define offPC offsetof(struct chip8, PC)
+
+/* al = V[y] */
+static uint8_t *loadAl(uint8_t *p, uint8_t y) {
+    p = emit8(p, 0x8A);
+    return emitRbx(p, 0, offV(y));
+}
+
+/* setc / setnc byte VF */
+static uint8_t *setFlag(uint8_t *p, uint8_t setcc) {
+    p = emit8(p, 0x0F);
+    p = emit8(p, setcc);
+    return emitRbx(p, 0, offV(0x0F));
+}
+
+/* mov byte [Vx], al */
+static uint8_t *storeAl(uint8_t *p, uint8_t x) {
+    p = emit8(p, 0x88);
+    return emitRbx(p, 0, offV(x));
+}
+
+/* mov byte VF, 0 */
+static uint8_t *clearFlag(uint8_t *p) {
+    p = emit8(p, 0xC6);
+    p = emitRbx(p, 0, offV(0x0F));
+    return emit8(p, 0);
+}
+
+/* Translate one instruction, or return NULL if it has to be interpreted.
+ * Quirks are baked in - changing them flushes every block. */
+static uint8_t *translate(uint8_t *p, uint8_t b1, uint8_t b2, const bool *quirks) {
+    const uint8_t x = b1 & 0xF, y = b2 >> 4;
+
+    switch (b1 >> 4) {
+        case 0x06: /* mov byte [Vx], NN */
+            p = emit8(p, 0xC6);
+            p = emitRbx(p, 0, offV(x));
+            return emit8(p, b2);
+
+        case 0x07: /* add byte [Vx], NN */
+            p = emit8(p, 0x80);
+            p = emitRbx(p, 0, offV(x));
+            return emit8(p, b2);
+
+        case 0x08:
+            switch (b2 & 0xF) {
+                case 0x00: /* Vx = Vy */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x88);
+                    return emitRbx(p, 0, offV(x));
+
+                case 0x01: /* Vx |= Vy (VF = 0) */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x08);
+                    p = emitRbx(p, 0, offV(x));
+                    return quirks[quirkVfReset] ? clearFlag(p) : p;
+
+                case 0x02: /* Vx &= Vy (VF = 0) */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x20);
+                    p = emitRbx(p, 0, offV(x));
+                    return quirks[quirkVfReset] ? clearFlag(p) : p;
+
+                case 0x03: /* Vx ^= Vy (VF = 0) */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x30);
+                    p = emitRbx(p, 0, offV(x));
+                    return quirks[quirkVfReset] ? clearFlag(p) : p;
+
+                case 0x04: /* Vx += Vy, VF = carry */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x00);
+                    p = emitRbx(p, 0, offV(x));
+                    return setFlag(p, 0x92);
+
+                case 0x05: /* Vx -= Vy, VF = no borrow */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x28);
+                    p = emitRbx(p, 0, offV(x));
+                    return setFlag(p, 0x93);
+
+                case 0x06: /* (Vx = Vy) shr byte [Vx], 1, VF = shifted out bit */
+                    if (quirks[quirkShiftVy]) p = storeAl(loadAl(p, y), x);
+                    p = emit8(p, 0xD0);
+                    p = emitRbx(p, 5, offV(x));
+                    return setFlag(p, 0x92);
+
+                case 0x07: /* Vx = Vy - Vx, VF = no borrow */
+                    p = loadAl(p, y);
+                    p = emit8(p, 0x2A);
+                    p = emitRbx(p, 0, offV(x));
+                    p = emit8(p, 0x88);
+                    p = emitRbx(p, 0, offV(x));
+                    return setFlag(p, 0x93);
+
+                case 0x0E: /* (Vx = Vy) shl byte [Vx], 1, VF = shifted out bit */
+                    if (quirks[quirkShiftVy]) p = storeAl(loadAl(p, y), x);
+                    p = emit8(p, 0xD0);
+                    p = emitRbx(p, 4, offV(x));
+                    return setFlag(p, 0x92);
+            }
+            return NULL;
+
+        case 0x0A: /* mov word [I], NNN */
+            p = emit8(p, 0x66);
+            p = emit8(p, 0xC7);
+            p = emitRbx(p, 0, offI);
+            return emit16(p, ((b1 & 0xF) << 8) | b2);
+
+        case 0x0F:
+            if (b2 == 0x1E) { /* movzx eax, byte [Vx]; add word [I], ax */
+                p = emit8(p, 0x0F);
+                p = emit8(p, 0xB6);
+                p = emitRbx(p, 0, offV(x));
+                p = emit8(p, 0x66);
+                p = emit8(p, 0x01);
+                return emitRbx(p, 0, offI);
+            }
+            return NULL;
+    }
+
+    return NULL;
+}
+
+/* Forget every block - used when the code buffer fills up */
+static void jitFlushAll(emuJit *jit) {
+    jit->used = 0;
+    memset(jit->block, 0, sizeof jit->block);
+    memset(jit->pageCode, 0, sizeof jit->pageCode);
+}
+
+/* Translate the block starting at addr, returns false if there is none */
+static bool jitCompile(chip8 *chip8, uint16_t addr) {
+    emuJit *jit = chip8->jit;
+    uint8_t *start, *p;
+    uint16_t pc = addr;
+    uint8_t count = 0;
+
+    if (jit->used + jitMaxBlockBytes > jitCodeSize) {
+        jitFlushAll(jit);
+    }
+
+    start = p = jit->code + jit->used;
+    p = emit8(p, 0x53); /* push rbx */
+    p = emit8(p, 0x48); /* mov rbx, rdi */
+    p = emit8(p, 0x89);
+    p = emit8(p, 0xFB);
+
+    while (count < jitMaxBlock) {
+        const uint8_t b1 = ramByte(chip8, pc);
+        const uint8_t b2 = ramByte(chip8, pc + 1);
+        uint8_t *next;
+
+        if ((b1 >> 4) == 0x01) {
+            /* 1NNN closes the block */
+            pc = ((b1 & 0xF) << 8) | b2;
+            count++;
+            break;
+        }
+
+        next = translate(p, b1, b2, chip8->quirks);
+        if (!next) break;
+
+        p = next;
+        pc += 2;
+        count++;
+    }
+
+    if (!count) {
+        /* Remembered until something is written over it */
+        jit->block[addr] = jitNone;
+        jit->length[addr] = 1;
+        jit->pageCode[addr >> 8] = true;
+        jit->pageCode[(uint16_t)(addr + 1) >> 8] = true;
+        return false;
+    }
+
+    p = emit8(p, 0x66); /* mov word [PC], pc */
+    p = emit8(p, 0xC7);
+    p = emitRbx(p, 0, offPC);
+    p = emit16(p, pc);
+    p = emit8(p, 0x5B); /* pop rbx */
+    p = emit8(p, 0xC3); /* ret */
+
+    jit->block[addr] = (uint32_t)(start - jit->code) + 1;
+    jit->length[addr] = count;
+    jit->used = p - jit->code;
+
+    /* Remember which pages this block was read from */
+    {
+        uint16_t a = addr;
+        uint8_t i;
+        for (i = 0; i < count; i++, a += 2) {
+            jit->pageCode[a >> 8] = true;
+            jit->pageCode[(uint16_t)(a + 1) >> 8] = true;
+        }
+    }
+
+    return true;
+}
+
+bool initJit(chip8 *chip8) {
+    emuJit *jit;
+
+    if (chip8->jit) {
+        jitFlushAll(chip8->jit);
+        return 1; /* true */
+    }
+
+    jit = malloc(sizeof *jit);
+    if (!jit) return 0; /* false */
+
+    jit->code = mmap(NULL, jitCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return 0; /* false */
+    }
+
+    jitFlushAll(jit);
+    chip8->jit = jit;
+    return 1; /* true */
+}
+
+void freeJit(chip8 *chip8) {
+    if (chip8->jit) {
+        munmap(chip8->jit->code, jitCodeSize);
+        free(chip8->jit);
+        chip8->jit = NULL;
+    }
+}
+
+void jitFlush(chip8 *chip8) {
+    if (chip8->jit) {
+        jitFlushAll(chip8->jit);
+    }
+}
+
+/* A store hit addr - drop every block translated from that page */
+void jitInvalidate(chip8 *chip8, uint16_t addr) {
+    emuJit *jit = chip8->jit;
+    const uint8_t page = addr >> 8;
+    long a, first, last;
+
+    if (!jit->pageCode[page]) return;
+    jit->pageCode[page] = false;
+
+    /* Blocks that start up to one block length before the page can reach into it */
+    first = ((long)page << 8) - jitMaxBlock * 2;
+    last = ((long)page << 8) + 0xFF;
+    if (first < 0) first = 0;
+
+    for (a = first; a <= last; a++) {
+        if (jit->block[a] && a + jit->length[a] * 2 > ((long)page << 8)) {
+            jit->block[a] = 0;
+        }
+    }
+}
+
+/* Run the block at PC if it fits in budget instructions.
+ * Returns the number of instructions it retired, 0 to interpret instead. */
+unsigned long jitRun(chip8 *chip8, unsigned long budget) {
+    emuJit *jit = chip8->jit;
+    uint32_t block = jit->block[chip8->PC];
+    jitFn fn;
+
+    if (!block) {
+        if (!jitCompile(chip8, chip8->PC)) return 0;
+        block = jit->block[chip8->PC];
+    }
+
+    if (block == jitNone || jit->length[chip8->PC] > budget) return 0;
+
+    budget = jit->length[chip8->PC];
+    fn = (jitFn)(void *)(jit->code + block - 1);
+    fn(chip8);
+
+    return budget;
+}
+
+#else /* No recompiler for this host - execute() handles everything */
+
+bool initJit(chip8 *chip8) {
+    (void)chip8;
+    return 0; /* false */
+}
+
+void freeJit(chip8 *chip8) {
+    (void)chip8;
+}
+
+void jitFlush(chip8 *chip8) {
+    (void)chip8;
+}
+
+void jitInvalidate(chip8 *chip8, uint16_t addr) {
+    (void)chip8; (void)addr;
+}
+
+unsigned long jitRun(chip8 *chip8, unsigned long budget) {
+    (void)chip8; (void)budget;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * RAM pages and shared ROM images
+ *
+ * Built with -DSUNCHIP_PAGED_RAM, an instance's RAM is a table of page
+ * pointers. Pages start out pointing into a read-only emuImage shared by
+ * every instance running the same ROM (or at one shared zero page), and a
+ * page is copied into the instance the first time something writes to it.
+ * Reads are a table lookup and a load, with no ownership test.
+ *
+ * Without the flag RAM is the flat ram[] array, images are just copied
+ * in, and the same calls work unchanged.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+struct emuImage {
+    uint8_t ram[maxRam];
+    bool zero[ramPages]; /* Page is all zero, map the shared zero page */
+};
+
+#ifdef SUNCHIP_PAGED_RAM
+
+static uint8_t zeroPage[ramPageSize]; /* Never written - writes copy it first */
+
+#define pageOwned(chip8, page) ((chip8)->ownedPages[(page) >> 5] & (1u << ((page) & 31)))
+
+/* Pointer to page that is safe to write, copying it on first use.
+ * NULL if the copy couldn't be allocated. */
+uint8_t *writablePage(chip8 *chip8, unsigned page) {
+    uint8_t *copy;
+
+    if (pageOwned(chip8, page)) return chip8->pages[page];
+
+    copy = malloc(ramPageSize);
+    if (!copy) {
+        puts("Out of memory copying a RAM page");
+        return NULL;
+    }
+
+    memcpy(copy, chip8->pages[page], ramPageSize);
+    chip8->pages[page] = copy;
+    chip8->ownedPages[page >> 5] |= 1u << (page & 31);
+    return copy;
+}
+
+/* Drop every page this instance copied */
+void freePages(chip8 *chip8) {
+    unsigned page;
+
+    for (page = 0; page < ramPages; page++) {
+        if (pageOwned(chip8, page)) {
+            free(chip8->pages[page]);
+            chip8->pages[page] = zeroPage;
+        }
+    }
+    memset(chip8->ownedPages, 0, sizeof chip8->ownedPages);
+}
+
+/* Point RAM at image (all zero if NULL), nothing is copied */
+void mapImage(chip8 *chip8, const emuImage *image) {
+    unsigned page;
+
+    freePages(chip8);
+
+    for (page = 0; page < ramPages; page++) {
+        /* Shared pages are only ever read, see writablePage() */
+        chip8->pages[page] = image && !image->zero[page] ? (uint8_t *)&image->ram[page * ramPageSize] : zeroPage;
+    }
+}
+
+#else
+
+uint8_t *writablePage(chip8 *chip8, unsigned page) {
+    return &chip8->ram[page * ramPageSize];
+}
+
+void freePages(chip8 *chip8) {
+    (void)chip8;
+}
+
+void mapImage(chip8 *chip8, const emuImage *image) {
+    if (image) {
+        memcpy(chip8->ram, image->ram, sizeof chip8->ram);
+    }
+}
+
+#endif
+
+/* Copy length bytes into RAM at addr (wrapping at the top), for loaders
+ * and hosts - instructions store through writeRam() */
+void storeRam(chip8 *chip8, uint16_t addr, const void *data, unsigned long length) {
+    const uint8_t *in = data;
+    unsigned long done = 0;
+
+    while (done < length) {
+        const uint16_t a = addr + done;
+        const unsigned offset = a & (ramPageSize - 1);
+        unsigned long chunk = ramPageSize - offset;
+        uint8_t *page = writablePage(chip8, a / ramPageSize);
+
+        if (chunk > length - done) chunk = length - done;
+        if (page) memcpy(page + offset, in + done, chunk);
+        done += chunk;
+    }
+
+    ramChanged(chip8, addr, length);
+}
+
+/* Put length bytes of read-only data in RAM at page aligned addr, for
+ * data that stays put at least as long as the instance (a ROM pack
+ * mapping). The paged model points RAM straight at data, so it must be
+ * zero padded to whole pages; the flat one copies length bytes. */
+void mapRam(chip8 *chip8, uint16_t addr, const uint8_t *data, unsigned long length) {
+#ifdef SUNCHIP_PAGED_RAM
+    unsigned long done;
+
+    for (done = 0; done < length; done += ramPageSize) {
+        const unsigned page = (uint16_t)(addr + done) / ramPageSize;
+
+        if (pageOwned(chip8, page)) {
+            free(chip8->pages[page]);
+            chip8->ownedPages[page >> 5] &= ~(1u << (page & 31));
+        }
+        /* Only ever read, see writablePage() */
+        chip8->pages[page] = (uint8_t *)&data[done];
+    }
+
+    ramChanged(chip8, addr, length);
+#else
+    storeRam(chip8, addr, data, length);
+#endif
+}
+
+/* Snapshot the RAM of an initialized instance (font, pattern and ROM) so
+ * other instances can share it, see chip8->image */
+emuImage *createImage(const chip8 *chip8) {
+    emuImage *image = malloc(sizeof *image);
+    unsigned page, i;
+
+    if (!image) return NULL;
+
+    for (page = 0; page < ramPages; page++) {
+        const uint8_t *from = ramPage(chip8, page);
+        uint8_t any = 0;
+
+        memcpy(&image->ram[page * ramPageSize], from, ramPageSize);
+        for (i = 0; i < ramPageSize; i++) any |= from[i];
+        image->zero[page] = !any;
+    }
+
+    return image;
+}
+
+/* Free only once no instance maps it any more */
+void freeImage(emuImage *image) {
+    free(image);
+}
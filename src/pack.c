@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Memory-mapped ROM packs
+ *
+ * A pack is every ROM of a library in one file, built by tools/mkpack: an
+ * index up front, then the ROMs, each starting on a RAM page boundary and
+ * zero padded to whole pages. Opening one is a single mmap() of the file,
+ * shared and read-only, and a ROM is found by name or SHA-1 in the index
+ * without touching the rest. Loading copies it into RAM once; with
+ * -DSUNCHIP_PAGED_RAM its pages are mapped straight from the pack instead,
+ * see mapRam(). All values are little-endian:
+ *
+ *     "SCPK" version:2 reserved:2 count:4 reserved:4
+ *     name:88 sha1:20 offset:4 size:4 cpuHz:4 platform:1 reserved:7   (count entries)
+ *     ROM data
+ */
+
+#define _POSIX_C_SOURCE 200112L /* mmap, open, fstat */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/chip8.h"
+
+#define packHeaderSize 16
+#define packEntrySize 128
+
+struct emuPack {
+    const uint8_t *map;
+    size_t length;
+    unsigned long count;
+};
+
+static uint32_t get32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static const uint8_t *entry(const emuPack *pack, unsigned long index) {
+    return pack->map + packHeaderSize + index * packEntrySize;
+}
+
+/* Map the pack at path and check its index - NULL if it isn't one */
+emuPack *openPack(const char *path) {
+    const int fd = open(path, O_RDONLY);
+    emuPack *pack;
+    struct stat info;
+    void *map;
+    unsigned long i;
+
+    if (fd < 0) {
+        printf("Could not open ROM pack %s\n", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &info) || info.st_size < packHeaderSize) {
+        printf("Not a ROM pack: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    /* Shared so every process running the pack reads the same page cache */
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Could not map ROM pack %s\n", path);
+        return NULL;
+    }
+
+    pack = malloc(sizeof *pack);
+    if (!pack) {
+        munmap(map, info.st_size);
+        return NULL;
+    }
+
+    pack->map = map;
+    pack->length = info.st_size;
+    pack->count = get32(&pack->map[8]);
+
+    if (memcmp(pack->map, packMagic, 4) || (pack->map[4] | (pack->map[5] << 8)) != packVersion ||
+        pack->count > (pack->length - packHeaderSize) / packEntrySize) {
+        printf("Not a ROM pack: %s\n", path);
+        closePack(pack);
+        return NULL;
+    }
+
+    /* Every entry is checked once here so lookups can trust the index */
+    for (i = 0; i < pack->count; i++) {
+        const uint8_t *e = entry(pack, i);
+        const uint32_t offset = get32(&e[108]), size = get32(&e[112]);
+        const unsigned long padded = (size + ramPageSize - 1) & ~(unsigned long)(ramPageSize - 1);
+
+        if (e[packNameSize - 1] || offset % ramPageSize || size > maxRam - pcStartDefault ||
+            offset > pack->length || padded > pack->length - offset) {
+            printf("Corrupt ROM pack %s, entry %lu\n", path, i);
+            closePack(pack);
+            return NULL;
+        }
+    }
+
+    return pack;
+}
+
+/* Unmap - nothing may be running from the pack any more */
+void closePack(emuPack *pack) {
+    if (!pack) return;
+
+    munmap((void *)pack->map, pack->length);
+    free(pack);
+}
+
+unsigned long packCount(const emuPack *pack) {
+    return pack->count;
+}
+
+/* The index'th ROM, in the order the pack was built */
+bool packRom(const emuPack *pack, unsigned long index, emuPackRom *rom) {
+    const uint8_t *e;
+
+    if (index >= pack->count) return 0; /* false */
+
+    e = entry(pack, index);
+    rom->name = (const char *)e;
+    rom->sha1 = &e[packNameSize];
+    rom->data = pack->map + get32(&e[108]);
+    rom->size = get32(&e[112]);
+    rom->cpuHz = get32(&e[116]);
+    rom->platform = (EMUPLATFORM)(e[120] <= platformXoChip ? e[120] : platformCustom);
+    return 1; /* true */
+}
+
+/* Parse 40 hex digits into a digest */
+static bool parseHash(const char *text, uint8_t digest[20]) {
+    int i;
+
+    if (strlen(text) != 40) return 0; /* false */
+
+    for (i = 0; i < 40; i++) {
+        const char c = text[i];
+        const int nibble = c >= '0' && c <= '9' ? c - '0' :
+                           c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                           c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+
+        if (nibble < 0) return 0; /* false */
+        if (i & 1) digest[i / 2] |= nibble;
+        else digest[i / 2] = nibble << 4;
+    }
+
+    return 1; /* true */
+}
+
+/* Look key up as a SHA-1 in hex, then as a name. A straight walk of the
+ * index - it is small and already mapped, so thousands of ROMs are still
+ * a few microseconds. */
+bool findPackRom(const emuPack *pack, const char *key, emuPackRom *rom) {
+    uint8_t digest[20];
+    const bool hash = parseHash(key, digest);
+    unsigned long i;
+
+    for (i = 0; i < pack->count; i++) {
+        const uint8_t *e = entry(pack, i);
+
+        if (hash ? !memcmp(&e[packNameSize], digest, 20) : !strcmp((const char *)e, key)) {
+            return packRom(pack, i, rom);
+        }
+    }
+
+    return 0; /* false */
+}
+
+/* Load the ROM key names or hashes at pcStartDefault, see mapRam() */
+bool loadPackRom(chip8 *chip8, const emuPack *pack, const char *key) {
+    emuPackRom rom;
+
+    if (!findPackRom(pack, key, &rom)) {
+        printf("No ROM %s in the pack\n", key);
+        return 0; /* false */
+    }
+
+    mapRam(chip8, pcStartDefault, rom.data, rom.size);
+    chip8->rom = rom.name;
+    return 1; /* true */
+}
+
+/* SHA-1 (FIPS 180-4) */
+#define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+static void sha1Block(uint32_t state[5], const uint8_t *block) {
+    uint32_t w[80], a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (; i < 80; i++) {
+        w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    for (i = 0; i < 80; i++) {
+        const uint32_t f = i < 20 ? ((b & c) | (~b & d)) + 0x5A827999 :
+                           i < 40 ? (b ^ c ^ d) + 0x6ED9EBA1 :
+                           i < 60 ? ((b & c) | (b & d) | (c & d)) + 0x8F1BBCDC :
+                                    (b ^ c ^ d) + 0xCA62C1D6;
+        const uint32_t t = rol(a, 5) + f + e + w[i];
+
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha1(const void *data, unsigned long length, uint8_t digest[20]) {
+    const uint8_t *in = data;
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t last[128];
+    const unsigned long tail = length % 64;
+    const unsigned long lastSize = tail < 56 ? 64 : 128;
+    const uint64_t bits = (uint64_t)length * 8;
+    unsigned long i;
+
+    for (i = 0; i + 64 <= length; i += 64) {
+        sha1Block(state, in + i);
+    }
+
+    /* Remaining bytes, a 1 bit, zeros and the length in bits */
+    memset(last, 0, sizeof last);
+    memcpy(last, in + i, tail);
+    last[tail] = 0x80;
+    for (i = 0; i < 8; i++) {
+        last[lastSize - 1 - i] = (uint8_t)(bits >> (i * 8));
+    }
+
+    sha1Block(state, last);
+    if (lastSize == 128) sha1Block(state, last + 64);
+
+    for (i = 0; i < 20; i++) {
+        digest[i] = (uint8_t)(state[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
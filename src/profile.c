@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Opcode and PC hotspot profiler
+ *
+ * retire() and draw() bump the counters in chip8->profile directly; this
+ * file only allocates them and turns them into reports. The recompiler is
+ * bypassed while profiling so every instruction is counted.
+ */
+
+#define _POSIX_C_SOURCE 200112L /* clock_gettime */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/chip8.h"
+
+#define profileTopPCs 32 /* Addresses listed in the report */
+
+bool initProfile(chip8 *chip8) {
+    freeProfile(chip8);
+
+    chip8->profile = calloc(1, sizeof *chip8->profile);
+    return chip8->profile != NULL;
+}
+
+void freeProfile(chip8 *chip8) {
+    free(chip8->profile);
+    chip8->profile = NULL;
+}
+
+uint64_t profileNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Family is the high nibble; 00NN, E and F are told apart by the low
+ * byte and 8 by the low nibble. Other 0NNN share key 1 (SYS 001). */
+unsigned profileKey(uint16_t opcode) {
+    const unsigned c = opcode >> 12;
+
+    switch (c) {
+        case 0x00:
+            return (opcode & 0xFF00) ? 1 : opcode & 0xFF;
+        case 0x08:
+            return (c << 8) | (opcode & 0xF);
+        case 0x0E:
+        case 0x0F:
+            return (c << 8) | (opcode & 0xFF);
+    }
+
+    return c << 8;
+}
+
+/* Mnemonic pattern for a profileKey(), e.g. 8xy4, Fx07, DxyN */
+static void keyName(unsigned key, char *out) {
+    static const char *const patterns[16] = {
+        "0NNN", "1NNN", "2NNN", "3xNN", "4xNN", "5xy0", "6xNN", "7xNN",
+        "8xy%X", "9xy0", "ANNN", "BNNN", "CxNN", "DxyN", "Ex%02X", "Fx%02X"
+    };
+    const unsigned c = key >> 8, sub = key & 0xFF;
+
+    if (c == 0 && sub != 1) {
+        sprintf(out, "00%02X", sub);
+    }
+    else if (c == 0x08 || c == 0x0E || c == 0x0F) {
+        sprintf(out, patterns[c], sub);
+    }
+    else {
+        strcpy(out, patterns[c]);
+    }
+}
+
+/* Sort helpers - descending count */
+static const uint64_t *sortCounts;
+
+static int byCount(const void *a, const void *b) {
+    const uint64_t ca = sortCounts[*(const unsigned *)a], cb = sortCounts[*(const unsigned *)b];
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Indices of the non-zero counts, most frequent first */
+static unsigned sortedNonZero(const uint64_t *counts, unsigned length, unsigned *order) {
+    unsigned i, used = 0;
+
+    for (i = 0; i < length; i++) {
+        if (counts[i]) order[used++] = i;
+    }
+
+    sortCounts = counts;
+    qsort(order, used, sizeof *order, byCount);
+    return used;
+}
+
+/* Human readable report: opcode families, hottest addresses, draw heights
+ * and where the time went */
+void profileReport(const chip8 *chip8, FILE *file) {
+    const emuProfile *profile = chip8->profile;
+    unsigned *order;
+    uint64_t total = 0, draws = 0;
+    unsigned used, i;
+    char name[8];
+
+    if (!profile) return;
+
+    order = malloc(maxRam * sizeof *order);
+    if (!order) return;
+
+    for (i = 0; i < profileOps; i++) total += profile->ops[i];
+    for (i = 0; i < 16; i++) draws += profile->drawRows[i];
+
+    fprintf(file, "Profile: %s, %llu instructions\n\n", chip8->rom ? chip8->rom : "-", (unsigned long long)total);
+
+    fprintf(file, "Opcode        count      %%\n");
+    used = sortedNonZero(profile->ops, profileOps, order);
+    for (i = 0; i < used; i++) {
+        const uint64_t count = profile->ops[order[i]];
+        keyName(order[i], name);
+        fprintf(file, "%-6s %14llu %6.2f\n", name, (unsigned long long)count, 100.0 * count / total);
+    }
+
+    fprintf(file, "\nAddress  Opcode        count      %%\n");
+    used = sortedNonZero(profile->pc, maxRam, order);
+    for (i = 0; i < used && i < profileTopPCs; i++) {
+        const unsigned addr = order[i];
+        const uint64_t count = profile->pc[addr];
+        fprintf(file, "0x%04X   %02X%02X   %14llu %6.2f\n", addr, ramByte(chip8, addr), ramByte(chip8, addr + 1),
+                (unsigned long long)count, 100.0 * count / total);
+    }
+
+    fprintf(file, "\nSprite rows        count      %%\n");
+    for (i = 0; i < 16; i++) {
+        if (profile->drawRows[i]) {
+            fprintf(file, "%2u          %14llu %6.2f\n", i ? i : 16, (unsigned long long)profile->drawRows[i],
+                    100.0 * profile->drawRows[i] / draws);
+        }
+    }
+
+    fprintf(file, "\nTime in draw()  %10.3f ms\n", profile->drawNanos / 1e6);
+    fprintf(file, "Everything else %10.3f ms\n",
+            (profile->runNanos > profile->drawNanos ? profile->runNanos - profile->drawNanos : 0) / 1e6);
+
+    free(order);
+}
+
+/* Folded stacks for flamegraph.pl and friends, weighted by instruction
+ * count: execute;<family>;<address> count */
+void profileFolded(const chip8 *chip8, FILE *file) {
+    const emuProfile *profile = chip8->profile;
+    unsigned addr;
+    char name[8];
+
+    if (!profile) return;
+
+    for (addr = 0; addr < maxRam; addr++) {
+        if (profile->pc[addr]) {
+            keyName(profileKey((ramByte(chip8, addr) << 8) | ramByte(chip8, addr + 1)), name);
+            fprintf(file, "execute;%s;0x%04X %llu\n", name, addr, (unsigned long long)profile->pc[addr]);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Quirk dependent instruction handlers
+ *
+ * chip8.c includes this once per interpreter variant, after defining
+ *
+ *     variant(name)   - the variant's name for name, e.g. name##Chip8
+ *     quirkOn(quirk)  - 0 or 1 for a preset, chip8->quirks[quirk] for
+ *                       the generic variant
+ *
+ * With the quirks constant the compiler drops every quirk test, so each
+ * preset gets its own branch free handlers. No include guard on purpose;
+ * both macros are undefined at the end.
+ */
+
+/* XOR a sprite into each selected plane of packed VRAM - each row is a
+ * couple of shifts, an AND for the collision flag and an XOR, clipped or
+ * wrapped with masks. N rows of 8 pixels, or 16x16 for Dxy0; with both
+ * planes selected the second plane's rows follow the first's. */
+static void variant(drawSprite)(chip8 *chip8, uint8_t x, uint8_t y, uint8_t N) {
+    const bool wrap = quirkOn(quirkWrap);
+    const int width = screenWidth(chip8), height = screenHeight(chip8);
+    const int rows = N ? N : 16, bytes = N ? 1 : 2, last = y + rows - 1;
+    uint16_t addr = chip8->I;
+    uint64_t collision = 0;
+    int p, i;
+#ifdef SUNCHIP_PROFILE
+    const uint64_t start = chip8->profile ? profileNanos() : 0;
+#endif
+
+    for (p = 0; p < 2; p++) {
+        uint64_t (*plane)[vramWords] = p ? chip8->vram2 : chip8->vram;
+        const uint16_t next = addr + rows * bytes;
+
+        if (!(chip8->bitMask & (1 << p))) continue;
+
+        for (i = 0; i < rows; i++, addr += bytes) {
+            uint64_t bits = ramByte(chip8, addr), row[vramWords];
+            uint64_t *line;
+
+            if (y + i >= height) {
+                /* Stop drawing if the bottom edge is hit */
+                if (!wrap) break;
+                line = plane[(y + i) % height];
+            }
+            else {
+                line = plane[y + i];
+            }
+
+            if (bytes == 2) bits = (bits << 8) | ramByte(chip8, addr + 1);
+            placeRow(row, bits, bytes * 8, x, width, wrap);
+
+            collision |= (line[0] & row[0]) | (line[1] & row[1]);
+            line[0] ^= row[0];
+            line[1] ^= row[1];
+        }
+
+        addr = next;
+    }
+
+    /* A wrapped sprite dirties the whole height, a clipped one stops at the edge */
+    if (chip8->bitMask) {
+        vramChanged(chip8, last < height || !wrap ? y : 0, last < height ? last : height - 1);
+    }
+
+    /* Carry flag is set if any sprite pixel hit a lit pixel */
+    chip8->V[0x0F] = (collision != 0);
+
+#ifdef SUNCHIP_PROFILE
+    if (chip8->profile) {
+        chip8->profile->drawRows[N & 0xF]++;
+        chip8->profile->drawNanos += profileNanos() - start;
+    }
+#endif
+}
+
+static void variant(opDrw)(chip8 *chip8, const emuDecoded *op) {
+    variant(drawSprite)(chip8, chip8->V[op->x] % screenWidth(chip8), chip8->V[op->y] % screenHeight(chip8), op->N);
+}
+
+static void variant(opOr)(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] |= chip8->V[op->y];
+    if (quirkOn(quirkVfReset)) chip8->V[0x0F] = 0;
+}
+
+static void variant(opAnd)(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] &= chip8->V[op->y];
+    if (quirkOn(quirkVfReset)) chip8->V[0x0F] = 0;
+}
+
+static void variant(opXor)(chip8 *chip8, const emuDecoded *op) {
+    chip8->V[op->x] ^= chip8->V[op->y];
+    if (quirkOn(quirkVfReset)) chip8->V[0x0F] = 0;
+}
+
+static void variant(opShr)(chip8 *chip8, const emuDecoded *op) {
+    const uint8_t value = chip8->V[quirkOn(quirkShiftVy) ? op->y : op->x];
+    chip8->V[op->x] = value >> 1;
+    chip8->V[0x0F] = value & 0x01;
+}
+
+static void variant(opShl)(chip8 *chip8, const emuDecoded *op) {
+    const uint8_t value = chip8->V[quirkOn(quirkShiftVy) ? op->y : op->x];
+    chip8->V[op->x] = value << 1;
+    chip8->V[0x0F] = value >> 7;
+}
+
+static void variant(opJpV0)(chip8 *chip8, const emuDecoded *op) {
+    chip8->PC = op->NNN + chip8->V[quirkOn(quirkJumpVx) ? op->x : 0];
+}
+
+static void variant(opStore)(chip8 *chip8, const emuDecoded *op) {
+    int r;
+    for (r = 0; r <= op->x; r++) {
+        writeRam(chip8, chip8->I + r, chip8->V[r]);
+    }
+    if (quirkOn(quirkLoadStoreI)) chip8->I += op->x + 1;
+}
+
+static void variant(opLoad)(chip8 *chip8, const emuDecoded *op) {
+    int r;
+    for (r = 0; r <= op->x; r++) {
+        chip8->V[r] = ramByte(chip8, chip8->I + r);
+    }
+    if (quirkOn(quirkLoadStoreI)) chip8->I += op->x + 1;
+}
+
+static const emuQuirkOps variant(quirkOps) = {
+    variant(drawSprite),
+    variant(opDrw),
+    variant(opOr),
+    variant(opAnd),
+    variant(opXor),
+    variant(opShr),
+    variant(opShl),
+    variant(opJpV0),
+    variant(opStore),
+    variant(opLoad)
+};
+
+#undef variant
+#undef quirkOn
@@ -0,0 +1,244 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Rewind buffer
+ *
+ * The newest recorded frame is kept in full as a save state (the
+ * keyframe). Every frame pushed adds a record holding the XOR of the new
+ * frame with the one before it - registers, both VRAM planes and only the
+ * RAM pages written in between - run length encoded, so an idle frame
+ * costs a few dozen bytes. Stepping back XORs the newest record into the
+ * keyframe, which then is the previous frame.
+ *
+ * Records live back to back in a byte ring of fixed size; the oldest are
+ * dropped to make room, so memory use never grows past what
+ * createRewind() allocated.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+#define maxRecord (4 + ramPages + (sizeof(emuRegs) + 2 * sizeof(uint64_t) * hiresHeight * vramWords + maxRam) * 2)
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} rewindSlot;
+
+struct emuRewind {
+    emuState head; /* Newest recorded frame */
+    uint8_t *data; /* Record bytes */
+    uint32_t size;
+    uint32_t end; /* Where the newest record ends */
+    rewindSlot *slots; /* One per recorded frame, oldest at first */
+    unsigned long maxSlots;
+    unsigned long first;
+    unsigned long count;
+    uint8_t *scratch; /* Record being encoded */
+    uint8_t *old; /* Previous contents of the pages being saved */
+    emuRegs oldRegs;
+    uint64_t oldVram[hiresHeight][vramWords];
+    uint64_t oldVram2[hiresHeight][vramWords];
+};
+
+/* Encode a ^ b: runs of (zero count, literal count, literals) */
+static uint8_t *rleXor(uint8_t *out, const void *a, const void *b, size_t length) {
+    const uint8_t *x = a, *y = b;
+    size_t i = 0;
+
+    while (i < length) {
+        uint8_t zeros = 0, literals = 0;
+
+        while (i < length && zeros < 255 && x[i] == y[i]) {
+            zeros++;
+            i++;
+        }
+
+        *out++ = zeros;
+        while (i + literals < length && literals < 255 && x[i + literals] != y[i + literals]) {
+            out[1 + literals] = x[i + literals] ^ y[i + literals];
+            literals++;
+        }
+        *out = literals;
+        out += 1 + literals;
+        i += literals;
+    }
+
+    return out;
+}
+
+/* target ^= decoded bytes, returns the first byte after the encoding */
+static const uint8_t *unRleXor(const uint8_t *in, void *target, size_t length) {
+    uint8_t *t = target;
+    size_t i = 0;
+
+    while (i < length) {
+        uint8_t literals;
+
+        i += *in++;
+        literals = *in++;
+        while (literals--) {
+            t[i++] ^= *in++;
+        }
+    }
+
+    return in;
+}
+
+/* Allocate a rewind buffer using about capBytes for history */
+emuRewind *createRewind(size_t capBytes) {
+    emuRewind *history = calloc(1, sizeof *history);
+
+    if (!history) return NULL;
+
+    /* A tiny frame record is around 40 bytes, budget one slot per 64 */
+    history->maxSlots = capBytes / 64 + 1;
+    history->size = capBytes - (history->maxSlots - 1) * sizeof *history->slots;
+    if (history->size < maxRecord) history->size = maxRecord;
+
+    history->data = malloc(history->size);
+    history->slots = malloc(history->maxSlots * sizeof *history->slots);
+    history->scratch = malloc(maxRecord);
+    history->old = malloc(maxRam);
+
+    if (!history->data || !history->slots || !history->scratch || !history->old) {
+        freeRewind(history);
+        return NULL;
+    }
+
+    return history;
+}
+
+void freeRewind(emuRewind *history) {
+    if (history) {
+        free(history->data);
+        free(history->slots);
+        free(history->scratch);
+        free(history->old);
+        free(history);
+    }
+}
+
+/* Number of frames that can be stepped back */
+unsigned long rewindFrames(const emuRewind *history) {
+    return history->count;
+}
+
+static void dropOldest(emuRewind *history) {
+    history->first = (history->first + 1) % history->maxSlots;
+    history->count--;
+}
+
+/* Copy a finished record into the ring, evicting the oldest as needed */
+static void store(emuRewind *history, uint32_t length) {
+    const uint32_t pos = (history->end + length <= history->size) ? history->end : 0;
+    rewindSlot *slot;
+
+    while (history->count) {
+        const rewindSlot *oldest = &history->slots[history->first];
+        const bool skipped = (pos == 0 && oldest->offset >= history->end); /* Tail we're wrapping past */
+        const bool overlap = (oldest->offset < pos + length && oldest->offset + oldest->length > pos);
+
+        if (!skipped && !overlap && history->count < history->maxSlots) break;
+        dropOldest(history);
+    }
+
+    memcpy(&history->data[pos], history->scratch, length);
+
+    slot = &history->slots[(history->first + history->count) % history->maxSlots];
+    slot->offset = pos;
+    slot->length = length;
+    history->count++;
+    history->end = pos + length;
+}
+
+/* Record the current frame - call once per frame */
+void rewindPush(emuRewind *history, chip8 *chip8) {
+    uint32_t pages[ramPages / 32];
+    uint8_t *out = history->scratch;
+    uint8_t *countAt;
+    unsigned long dirty = 0;
+    int page;
+
+    if (history->head.owner != chip8 || history->head.serial != chip8->stateSerial) {
+        /* Loaded or reset behind our back - start a new history */
+        history->count = 0;
+        history->end = 0;
+        saveState(chip8, &history->head);
+        return;
+    }
+
+    /* Keep what saveState() is about to overwrite */
+    memcpy(pages, chip8->dirtyPages, sizeof pages);
+    history->oldRegs = history->head.regs;
+    memcpy(history->oldVram, history->head.vram, sizeof history->oldVram);
+    memcpy(history->oldVram2, history->head.vram2, sizeof history->oldVram2);
+    for (page = 0; page < ramPages; page++) {
+        if (pages[page >> 5] & (1u << (page & 31))) {
+            memcpy(&history->old[page * ramPageSize], &history->head.ram[page * ramPageSize], ramPageSize);
+        }
+    }
+
+    saveState(chip8, &history->head);
+
+    /* Record: page count, page numbers, then XOR runs for regs, VRAM and pages */
+    countAt = out;
+    out += 2;
+    for (page = 0; page < ramPages; page++) {
+        if (pages[page >> 5] & (1u << (page & 31))) {
+            *out++ = page;
+            dirty++;
+        }
+    }
+    countAt[0] = dirty & 0xFF;
+    countAt[1] = dirty >> 8;
+
+    out = rleXor(out, &history->head.regs, &history->oldRegs, sizeof history->oldRegs);
+    out = rleXor(out, history->head.vram, history->oldVram, sizeof history->oldVram);
+    out = rleXor(out, history->head.vram2, history->oldVram2, sizeof history->oldVram2);
+    for (page = 0; page < ramPages; page++) {
+        if (pages[page >> 5] & (1u << (page & 31))) {
+            out = rleXor(out, &history->head.ram[page * ramPageSize], &history->old[page * ramPageSize], ramPageSize);
+        }
+    }
+
+    store(history, out - history->scratch);
+}
+
+/* Step back one recorded frame. Returns false when history is exhausted. */
+bool rewindPop(emuRewind *history, chip8 *chip8) {
+    const rewindSlot *slot;
+    const uint8_t *in, *pageList;
+    unsigned long dirty, i;
+
+    if (!history->count) return false;
+
+    slot = &history->slots[(history->first + history->count - 1) % history->maxSlots];
+    in = &history->data[slot->offset];
+
+    dirty = in[0] | (in[1] << 8);
+    pageList = in + 2;
+    in = pageList + dirty;
+
+    in = unRleXor(in, &history->head.regs, sizeof history->head.regs);
+    in = unRleXor(in, history->head.vram, sizeof history->head.vram);
+    in = unRleXor(in, history->head.vram2, sizeof history->head.vram2);
+    for (i = 0; i < dirty; i++) {
+        in = unRleXor(in, &history->head.ram[pageList[i] * ramPageSize], ramPageSize);
+
+        /* Make loadState() copy the pages we just changed */
+        markDirty(chip8, pageList[i] * ramPageSize);
+    }
+
+    history->count--;
+    if (history->count) {
+        const rewindSlot *newest = &history->slots[(history->first + history->count - 1) % history->maxSlots];
+        history->end = newest->offset + newest->length;
+    }
+    else {
+        history->end = 0;
+    }
+
+    loadState(chip8, &history->head);
+    return true;
+}
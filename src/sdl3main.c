@@ -1,23 +1,138 @@
 /* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD) */
-#include "chip8.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
 #include "../include/chip8.h"
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_audio.h>
 
-/* Emulator */
-int soundByte = 0;
+/* Emulator - the emulation thread runs frames, the main thread handles
+ * events and draws whatever frame was published last */
+bool quit = false; /* Window closed, Escape pressed or the ROM exited */
+emuFrames *frames = NULL;
+uint64_t frameStart = 0; /* SDL_GetTicksNS() at the start of the frame being emulated */
+bool redraw = false; /* Window exposed, present the last frame again - main thread only */
+
+/* Requests from the main thread, carried out between frames */
+typedef enum {
+    requestSave = 1, /* F5 */
+    requestLoad = 2, /* F8 */
+    requestTrace = 4, /* F9 */
+    requestPause = 8 /* Space */
+} EMUREQUEST;
+
+unsigned requests = 0;
+
+void request(EMUREQUEST what) {
+    __atomic_fetch_or(&requests, what, __ATOMIC_RELEASE);
+}
+
+/* Instruction trace target (-t), rewritten on F9, at exit and on a crash */
+FILE *traceFile = NULL;
+chip8 *traceChip = NULL;
+
+void dumpTrace(void) {
+    if (traceFile && traceChip) {
+        rewind(traceFile);
+        traceDump(traceChip, traceFile, 0);
+    }
+}
+
+/* Rewind history, Backspace held steps back one frame per frame */
+emuRewind *history = NULL;
+bool rewinding = false;
+
+/* Quick save slot - F5 saves (and writes <rom>.state), F8 loads */
+emuState *quickState = NULL;
+bool quickSaved = false;
+
+void quickSave(chip8 *chip8) {
+    char path[4096];
+    FILE *file;
+
+    if (!quickState) return;
+
+    copyState(chip8, quickState); /* Keeps the rewind history going */
+    quickSaved = true;
+
+    sprintf(path, "%.4000s.state", chip8->rom);
+    file = fopen(path, "wb");
+    if (!file || !writeState(quickState, file)) {
+        printf("Could not write save state %s\n", path);
+    }
+    if (file) fclose(file);
+}
+
+/* Input log (-i) - rewinding or loading a state can't be replayed, so
+ * either one ends the log there */
+FILE *inputFile = NULL;
+
+void stopRecording(chip8 *chip8, const char *why) {
+    if (chip8->inputLog) {
+        printf("Input log stopped: %s\n", why);
+        stopInput(chip8);
+    }
+}
+
+void quickLoad(chip8 *chip8) {
+    if (quickState && quickSaved) {
+        stopRecording(chip8, "state loaded");
+        loadState(chip8, quickState);
+    }
+}
+
+void crashDump(int sig) {
+    /* Best effort - stdio isn't async-signal-safe, but we are going down anyway */
+    dumpTrace();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
 
 
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *screen; /* VRAM, one texel per CHIP-8 pixel - hi-res sized, low-res uses the top left */
+    SDL_Texture *lcd; /* Fake LCD grid, drawn over the screen */
+    SDL_Texture *lcdHires; /* Same at hi-res */
 } sdl_t;
 
 
+/* Build the fake LCD overlay for a width x height screen once: a bgColor
+ * outline around every pixel cell and transparent everywhere else, same
+ * look as outlining each lit pixel with SDL_RenderRect() */
+SDL_Texture *createLcd(SDL_Renderer *renderer, int width, int height, int scale, uint32_t bgColor) {
+    const int w = width * scale, h = height * scale;
+    uint32_t *pixels = malloc(w * h * sizeof *pixels);
+    SDL_Texture *lcd = NULL;
+    int x, y;
+
+    if (!pixels) return NULL;
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            const bool edge = (x % scale == 0 || x % scale == scale - 1 ||
+                               y % scale == 0 || y % scale == scale - 1);
+            pixels[y * w + x] = edge ? bgColor : 0;
+        }
+    }
+
+    lcd = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, w, h);
+    if (lcd) {
+        SDL_SetTextureBlendMode(lcd, SDL_BLENDMODE_BLEND);
+        SDL_UpdateTexture(lcd, NULL, pixels, w * sizeof *pixels);
+    }
+
+    free(pixels);
+    return lcd;
+}
+
 /* Initialize SDL */
 bool initSdl(sdl_t *sdl) {
-    if (SDL_Init(SDL_INIT_VIDEO) & SDL_INIT_VIDEO) {
+    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
         SDL_Log("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
         return -1;
     }
@@ -34,15 +149,29 @@ bool initSdl(sdl_t *sdl) {
     }
 
     sdl->renderer = SDL_CreateRenderer(sdl->window, NULL);
-    if (!sdl->window) {
+    if (!sdl->renderer) {
         SDL_Log("Could not create SDL renderer: %s\n", SDL_GetError());
         return -1;
     }
 
+    /* The GPU scales the screen up, nearest keeps pixels square */
+    sdl->screen = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, hiresWidth, hiresHeight);
+    if (!sdl->screen) {
+        SDL_Log("Could not create screen texture: %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_SetTextureScaleMode(sdl->screen, SDL_SCALEMODE_NEAREST);
+
+    sdl->lcd = createLcd(sdl->renderer, displayWidth, displayHeight, defaultScale, defaultBgColor);
+    sdl->lcdHires = createLcd(sdl->renderer, hiresWidth, hiresHeight, defaultScale / 2, defaultBgColor);
+
     return 1; /* true */
 }
 
 void cleanup(const sdl_t *sdl) {
+    SDL_DestroyTexture(sdl->lcdHires);
+    SDL_DestroyTexture(sdl->lcd);
+    SDL_DestroyTexture(sdl->screen);
     SDL_DestroyRenderer(sdl->renderer);
     SDL_DestroyWindow(sdl->window);
     SDL_Quit();
@@ -59,116 +188,65 @@ void sdlClear(const sdl_t sdl) {
     SDL_RenderClear(sdl.renderer);
 }
 
-/* Update window */
-void updateScr(const sdl_t sdl, const chip8 chip8) {
-    SDL_FRect rect = {.x = 0, .y = 0, .w = defaultScale, .h = defaultScale};
-
-    /* Grab colors */
-
-    const uint8_t fg_r = (defaultFgColor >> 24) & 0xFF;
-    const uint8_t fg_g = (defaultFgColor >> 16) & 0xFF;
-    const uint8_t fg_b = (defaultFgColor >> 8) & 0xFF;
-    const uint8_t fg_a = (defaultFgColor >> 0) & 0xFF;
-    /* Foreground */
-
-    const uint8_t bg_r = (defaultBgColor >> 24) & 0xFF;
-    const uint8_t bg_g = (defaultBgColor >> 16) & 0xFF;
-    const uint8_t bg_b = (defaultBgColor >> 8) & 0xFF;
-    const uint8_t bg_a = (defaultBgColor >> 0) & 0xFF;
-    /* Background */
-
-    /* Loop through pixels and draw a rectangle per pixel
-     *    This may not be the best approach but it will be used until SDL is no longer needed */
-    uint32_t i;
-    for (i = 0; i < sizeof chip8.vram; i++) {
-        /* Convert i value into XY coords */
-        rect.x = (i % displayWidth) * defaultScale;
-        rect.y = (i / displayWidth) * defaultScale;
-
-        if (chip8.vram[i]) {
-            /* Pixel is on = Draw FG */
-            SDL_SetRenderDrawColor(sdl.renderer, fg_r, fg_g, fg_b, fg_a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
-
-            if (chip8.fakeLcd) {
-                /* Draw fake "scanlines" */
-                SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-                SDL_RenderRect(sdl.renderer, &rect);
-            }
+/* Update window from a published frame - uploads only its dirty rows, if
+ * any, the texture keeps the rest from earlier frames, then at most two
+ * textured quads. With upload false the texture is presented as it is. */
+void updateScr(const sdl_t sdl, const emuFrame *frame, bool upload) {
+    const uint32_t palette[4] = {defaultBgColor, defaultFgColor, defaultPlane2Color, defaultBlendColor};
+    const SDL_FRect used = {0, 0, screenWidth(frame), screenHeight(frame)};
+    const SDL_Rect dirty = {0, frame->dirtyTop, screenWidth(frame), frame->dirtyBottom - frame->dirtyTop + 1};
+    SDL_Texture *lcd = frame->hires ? sdl.lcdHires : sdl.lcd;
+    void *pixels;
+    int pitch;
+
+    if (upload && frame->dirtyBottom >= frame->dirtyTop && SDL_LockTexture(sdl.screen, &dirty, &pixels, &pitch)) {
+        expandFrame(frame, frame->dirtyTop, frame->dirtyBottom, pixels, pitch, palette);
+        SDL_UnlockTexture(sdl.screen);
+    }
 
-        } else {
-            /* Pixel is on = Draw FG */
-            SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
-        }
+    SDL_RenderTexture(sdl.renderer, sdl.screen, &used, NULL);
+
+    if (frame->fakeLcd && lcd) {
+        /* Draw fake "scanlines" */
+        SDL_RenderTexture(sdl.renderer, lcd, NULL, NULL);
     }
+
     SDL_RenderPresent(sdl.renderer);
 }
 
-void squareWaveCallback(void *sendData, SDL_AudioStream *buffer, int bytes, int totalBytes) {
-    (void)sendData;
+/* Pull beeper samples from the event ring - runs on SDL's audio thread */
+void audioCallback(void *userData, SDL_AudioStream *stream, int bytes, int totalBytes) {
+    static float samples[512]; /* Only ever touched by the audio thread */
+    emuAudio *audio = userData;
+    int count = bytes / sizeof (float);
 
-    /* chip8 chip8 = {}; */
     (void)totalBytes;
 
-    bytes /= sizeof (float);
-    while (bytes > 0) {
-        float samples[2];
-        const int total = SDL_min(bytes, SDL_arraysize(samples));
-        int i;
-
-        for (i = 0; i < bytes; i++) {
-            const int freq = 440;
-            const float phase = soundByte * freq / 8000.0f;
-            samples[i] = SDL_sinf(phase * 2 * SDL_PI_F);
-            /* Get byte of buffer from next sample
-            buffer[i] = chip8.ram[audioStartDefault + (soundByte / 8)];
-
-            Get sample bit
-            buffer[i] <<= (soundByte % 8);
-            buffer[i] &= 0x80;
-
-            If sample is 1, set buffer to max volume
-            buffer[i] *= 0xFF;
-
-            Keep track of sound buffer */
-            soundByte++;
-            if (soundByte >= (audioSize * 8)) {
-                soundByte = 0;
-            }
-        }
+    while (count > 0) {
+        const int total = count < (int)SDL_arraysize(samples) ? count : (int)SDL_arraysize(samples);
 
-        soundByte %= 8000;
-
-        /* new data */
-        SDL_PutAudioStreamData(buffer, samples, total * sizeof (float));
-        bytes -= total; /* subtract stream */
+        audioRender(audio, samples, total);
+        SDL_PutAudioStreamData(stream, samples, total * sizeof (float));
+        count -= total;
     }
 }
 
-void playSound() {
-    soundByte = 0;
-
-    SDL_AudioSpec spec = {SDL_AUDIO_U8, 1, 0};
-    SDL_AudioStream *stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, squareWaveCallback, NULL);
-    SDL_ResumeAudioDevice(SDL_GetAudioStreamDevice(stream));
+/* One stream for the whole session, beeps are events on it */
+SDL_AudioStream *openAudio(chip8 *chip8) {
+    const SDL_AudioSpec spec = {SDL_AUDIO_F32, 1, defaultSampleRate};
+    SDL_AudioStream *stream;
 
-    SDL_PauseAudioDevice(1);
-}
-
-void stopSound() {
-    SDL_PauseAudioDevice(1);
-    SDL_CloseAudioDevice(1);
-}
+    if (!initAudio(chip8, defaultSampleRate)) return NULL;
 
-void soundEvent() {
-    chip8 chip8 = {};
-    if (chip8.beep) {
-        playSound();
-    }
-    else if (!chip8.beep) {
-        stopSound();
+    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, audioCallback, chip8->audio);
+    if (!stream) {
+        SDL_Log("Could not open audio device: %s\n", SDL_GetError());
+        freeAudio(chip8);
+        return NULL;
     }
+
+    SDL_ResumeAudioStreamDevice(stream);
+    return stream;
 }
 
 /* Convert SDL_Keycode to emulator key */
@@ -261,8 +339,17 @@ unsigned char sdlHex(SDL_Keycode key) {
     }
 }
 
-/* Handle event */
+/* Microseconds from since to an event's timestamp (both SDL_GetTicksNS()) */
+uint32_t keyOffset(uint64_t timestamp, uint64_t since) {
+    return timestamp > since ? (uint32_t)((timestamp - since) / 1000) : 0;
+}
+
+/* Handle event - main thread. Key changes are queued with how far into
+ * the emulation thread's current frame they happened, and the emulator
+ * plays them back with the same spacing in the next frame. Everything
+ * else that touches chip8 is left to the emulation thread as a request. */
 void event(chip8 *chip8) {
+    const uint64_t since = __atomic_load_n(&frameStart, __ATOMIC_ACQUIRE);
     SDL_Event event;
 
     while (SDL_PollEvent(&event)) {
@@ -271,32 +358,43 @@ void event(chip8 *chip8) {
 
         switch (event.type) {
             case SDL_EVENT_QUIT: /* Close window to quit emulator */
-                quit = true;
+                __atomic_store_n(&quit, true, __ATOMIC_RELEASE);
                 return;
 
+            case SDL_EVENT_WINDOW_EXPOSED: /* Window contents lost */
+                redraw = true;
+                break;
+
             case SDL_EVENT_KEY_DOWN:
                 switch (event.key.key) {
                     case SDLK_ESCAPE: /* Escape key quits emulator */
-                        quit = true;
+                        __atomic_store_n(&quit, true, __ATOMIC_RELEASE);
                         break;
 
-                    case SDLK_SPACE:
-                        /* Space bar */
-                        if (!paused) {
-                            paused = true; /* Pause */
-                            puts("Emulation paused");
-                            break;
-                        }
-                        else {
-                            paused = false; /* Resume/unpause */
-                            puts("Emulation resumed");
-                            break;
-                        }
+                    case SDLK_F5: /* Quick save */
+                        request(requestSave);
+                        break;
+
+                    case SDLK_F8: /* Quick load */
+                        request(requestLoad);
+                        break;
+
+                    case SDLK_BACKSPACE: /* Rewind while held */
+                        __atomic_store_n(&rewinding, true, __ATOMIC_RELAXED);
+                        break;
+
+                    case SDLK_F9: /* Dump the instruction trace */
+                        request(requestTrace);
+                        break;
+
+                    case SDLK_SPACE: /* Pause/resume */
+                        request(requestPause);
+                        break;
 
                     default:
                         keyhex = sdlHex(event.key.key);
-                        if (keyhex != 0x10) {
-                            chip8->keypad[keyhex] = keyDown;
+                        if (keyhex != 0x10 && !event.key.repeat) {
+                            queueKey(chip8, keyhex, true, keyOffset(event.key.timestamp, since));
                         }
 
                         break;
@@ -304,19 +402,203 @@ void event(chip8 *chip8) {
                 break;
 
             case SDL_EVENT_KEY_UP:
+                if (event.key.key == SDLK_BACKSPACE) {
+                    __atomic_store_n(&rewinding, false, __ATOMIC_RELAXED);
+                    break;
+                }
                 keyhex = sdlHex(event.key.key);
                 if (keyhex != 0x10) {
-                    chip8->keypad[keyhex] = keyReleased;
+                    queueKey(chip8, keyhex, false, keyOffset(event.key.timestamp, since));
                 }
                 break;
         }
     }
 }
 
+/* Apply queued key events straight away - for when no frame is run */
+void applyKeys(chip8 *chip8) {
+    emuKeyEvent keys[keyQueueSize];
+    const unsigned count = takeKeys(chip8, keys);
+    unsigned k;
+
+    for (k = 0; k < count; k++) {
+        chip8->keypad[keys[k].key] = (EMUKEYS)keys[k].state;
+    }
+}
+
+/* Frame pacing statistics, reported once a second and at exit */
+typedef struct {
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t jitterSum; /* Sum of |frame period - target| in microseconds */
+    uint64_t jitterMax;
+    uint64_t start; /* Performance counter at the start of the window */
+} schedStats;
+
+void reportStats(const schedStats *stats, uint64_t now, uint64_t freq, const char *label) {
+    const double seconds = (double)(now - stats->start) / freq;
+
+    if (!stats->frames || seconds <= 0) return;
+
+    printf("%s: %.1f fps, %.0f instructions/sec, jitter avg %lu us max %lu us\n", label,
+           stats->frames / seconds, stats->instructions / seconds,
+           (unsigned long)(stats->jitterSum / stats->frames), (unsigned long)stats->jitterMax);
+}
+
+/* Emulation thread - emulates a frame, publishes it for the main thread
+ * and sleeps what is left of it, with the scheduler running cpuHz /
+ * refreshHz instructions per frame paced against the performance counter */
+int emulate(void *data) {
+    chip8 *chip8 = data;
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t frameTicks = freq / chip8->refreshHz;
+    uint64_t deadline = SDL_GetPerformanceCounter() + frameTicks;
+    uint64_t lastFrame = deadline - frameTicks;
+    schedStats second = {0, 0, 0, 0, 0}, total = {0, 0, 0, 0, 0};
+    second.start = total.start = lastFrame;
+
+    while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+        const unsigned pending = __atomic_exchange_n(&requests, 0, __ATOMIC_ACQUIRE);
+        unsigned long ran = 0;
+
+        /* Keys queued from here on are stamped against this frame */
+        __atomic_store_n(&frameStart, SDL_GetTicksNS(), __ATOMIC_RELEASE);
+
+        if (pending & requestSave) quickSave(chip8);
+        if (pending & requestLoad) quickLoad(chip8);
+        if (pending & requestTrace) dumpTrace();
+        if (pending & requestPause) {
+            chip8->paused = !chip8->paused;
+            puts(chip8->paused ? "Emulation paused" : "Emulation resumed");
+        }
+
+        if (__atomic_load_n(&rewinding, __ATOMIC_RELAXED) && history) {
+            /* Step back one recorded frame */
+            stopRecording(chip8, "rewound");
+            rewindPop(history, chip8);
+            applyKeys(chip8);
+        }
+        else if (!chip8->paused) {
+            /* Emulate one frame worth of instructions, timers tick at timerHz */
+            ran = runFrame(chip8);
+            if (history) rewindPush(history, chip8);
+        }
+        else {
+            /* Keep the keypad in step with the keyboard while paused */
+            applyKeys(chip8);
+        }
+
+        publishFrame(frames, chip8);
+        if (chip8->exit) __atomic_store_n(&quit, true, __ATOMIC_RELEASE);
+
+        /* Sleep only what is left of the frame */
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (now < deadline) {
+            SDL_DelayNS((deadline - now) * 1000000000 / freq);
+            now = SDL_GetPerformanceCounter();
+            deadline += frameTicks;
+        }
+        else {
+            /* Fell behind - don't try to catch up with a burst of frames */
+            deadline = now + frameTicks;
+        }
+
+        /* Pacing statistics */
+        {
+            const uint64_t period = (now - lastFrame) * 1000000 / freq;
+            const uint64_t target = frameTicks * 1000000 / freq;
+            const uint64_t jitter = period > target ? period - target : target - period;
+            schedStats *stats[2];
+            int i;
+
+            stats[0] = &second;
+            stats[1] = &total;
+            for (i = 0; i < 2; i++) {
+                stats[i]->frames++;
+                stats[i]->instructions += ran;
+                stats[i]->jitterSum += jitter;
+                if (jitter > stats[i]->jitterMax) stats[i]->jitterMax = jitter;
+            }
+            lastFrame = now;
+
+            if (now - second.start >= freq) {
+                reportStats(&second, now, freq, "Last second");
+                memset(&second, 0, sizeof second);
+                second.start = now;
+            }
+        }
+    }
+
+    reportStats(&total, SDL_GetPerformanceCounter(), freq, "Session");
+    return 0;
+}
+
 /* Main loop */
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: %s [.ch8 file]\n", argv[0]);
+    chip8 chip8 = {};
+    const char *rom = NULL;
+    const char *trace = NULL;
+    const char *profile = NULL;
+    const char *input = NULL;
+    const char *packPath = NULL;
+    emuPack *pack = NULL;
+    unsigned long rewindMb = 16;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-s") && arg + 1 < argc) {
+            /* Instructions per second */
+            chip8.cpuHz = strtoul(argv[++arg], NULL, 10);
+        }
+        else if (!strcmp(argv[arg], "-r") && arg + 1 < argc) {
+            /* Rewind history size in MB, 0 disables it */
+            rewindMb = strtoul(argv[++arg], NULL, 10);
+        }
+        else if (!strcmp(argv[arg], "-t") && arg + 1 < argc) {
+            /* Binary trace file */
+            trace = argv[++arg];
+        }
+        else if (!strcmp(argv[arg], "-i") && arg + 1 < argc) {
+            /* Record keypad input for tools/replay */
+            input = argv[++arg];
+        }
+        else if (!strcmp(argv[arg], "-a") && arg + 1 < argc) {
+            /* ROM pack, the ROM is then a name or SHA-1 in it */
+            packPath = argv[++arg];
+        }
+        else if (!strcmp(argv[arg], "-p") && arg + 1 < argc) {
+            /* Profile report, folded stacks if it ends in .folded */
+            profile = argv[++arg];
+        }
+        else if (!strcmp(argv[arg], "-e") && arg + 1 < argc) {
+            /* Pick the instruction engine */
+            arg++;
+            if (!strcmp(argv[arg], "switch")) chip8.engine = engineSwitch;
+            else if (!strcmp(argv[arg], "cached")) chip8.engine = engineCached;
+            else if (!strcmp(argv[arg], "jit")) chip8.engine = engineJit;
+            else {
+                rom = NULL; /* Unknown engine - show usage */
+                break;
+            }
+        }
+        else if (!strcmp(argv[arg], "-q") && arg + 1 < argc) {
+            /* Quirk preset */
+            arg++;
+            if (!strcmp(argv[arg], "chip8")) chip8.platform = platformChip8;
+            else if (!strcmp(argv[arg], "schip")) chip8.platform = platformSuperChip;
+            else if (!strcmp(argv[arg], "xochip")) chip8.platform = platformXoChip;
+            else {
+                rom = NULL; /* Unknown preset - show usage */
+                break;
+            }
+        }
+        else {
+            rom = argv[arg];
+        }
+    }
+
+    if (!rom) {
+        printf("Usage: %s [-s instructions/sec] [-e cached|switch|jit] [-q chip8|schip|xochip] [-r rewind MB] [-t trace file] [-p profile file] [-i input log] [-a rom pack] [.ch8 file | pack name or SHA-1]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -326,30 +608,141 @@ int main(int argc, char **argv) {
 
     printf("*```(`UN``````*\n");
 
-    chip8 chip8 = {};
-    const char *rom = argv[1];
+    if (packPath) {
+        /* The pack's suggestions stand in for what wasn't given */
+        emuPackRom entry;
+
+        pack = openPack(packPath);
+        if (!pack) exit(EXIT_FAILURE);
+        if (findPackRom(pack, rom, &entry)) {
+            if (chip8.platform == platformCustom) chip8.platform = entry.platform;
+            if (!chip8.cpuHz) chip8.cpuHz = entry.cpuHz;
+        }
+        chip8.pack = pack;
+    }
+
+    if (!chip8.cpuHz) chip8.cpuHz = defaultSpeed;
+    chip8.timerHz = defaultTimerHz;
+    chip8.refreshHz = defaultRefreshHz;
     if (!initEmu(&chip8, rom)) exit(EXIT_FAILURE);
 
+    /* Audio stays open until exit, a missing device just means no beeps */
+    SDL_AudioStream *audio = openAudio(&chip8);
+
+    if (input) {
+        inputFile = fopen(input, "wb");
+        if (!inputFile || !recordInput(&chip8, inputFile)) {
+            printf("Could not record input to %s\n", input);
+        }
+    }
+
+    if (rewindMb) {
+        history = createRewind(rewindMb << 20);
+        if (!history) puts("Could not allocate the rewind buffer");
+    }
+
+    quickState = malloc(sizeof *quickState);
+    if (quickState) {
+        /* Pick up the slot saved by a previous session, F8 loads it */
+        char path[4096];
+        FILE *file;
+
+        sprintf(path, "%.4000s.state", chip8.rom);
+        file = fopen(path, "rb");
+        if (file) {
+            quickSaved = readState(quickState, file);
+            fclose(file);
+        }
+    }
+
+    if (trace) {
+#ifdef SUNCHIP_TRACE
+        traceFile = fopen(trace, "wb");
+        if (traceFile && initTrace(&chip8, 65536)) {
+            traceChip = &chip8;
+            signal(SIGSEGV, crashDump);
+            signal(SIGABRT, crashDump);
+            signal(SIGFPE, crashDump);
+        }
+        else {
+            printf("Could not start tracing to %s\n", trace);
+        }
+#else
+        puts("Tracing is not compiled in, rebuild with make TRACE=1");
+#endif
+    }
+
+    if (profile) {
+#ifdef SUNCHIP_PROFILE
+        if (!initProfile(&chip8)) {
+            puts("Could not allocate the profiler");
+        }
+#else
+        puts("Profiling is not compiled in, rebuild with make PROFILE=1");
+#endif
+    }
+
     printf("*...,)CHIP.v0.2*\n");
 
-    /* Emulator loop */
-    while (!quit) {
+    frames = createFrames();
+    if (!frames) exit(EXIT_FAILURE);
+
+    SDL_Thread *emulation = SDL_CreateThread(emulate, "emulation", &chip8);
+    if (!emulation) {
+        SDL_Log("Could not start the emulation thread: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    /* Event and render loop - draws each published frame once, presenting
+     * never holds up emulation. Frames are only published when the screen
+     * changed, so a static screen costs no uploads or presents at all. */
+    const emuFrame *shown = NULL;
+    while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+        const emuFrame *frame;
+
         /* Handle event */
         event(&chip8);
 
-        if (paused) continue;
-
-        /* Emulate instructions */
-        cycle(&chip8);
-        /* Set refresh rate to 60hz (16.67ms) */
-        SDL_Delay(16);
-        /* Clear screen */
-        sdlClear(sdl);
-        /* Update window */
-        updateScr(sdl, chip8);
+        frame = latestFrame(frames);
+        if (frame || (redraw && shown)) {
+            /* Clear screen */
+            sdlClear(sdl);
+            /* Update window */
+            updateScr(sdl, frame ? frame : shown, frame != NULL);
+            if (frame) shown = frame;
+            redraw = false;
+        }
+        else {
+            SDL_DelayNS(1000000); /* Nothing new, look again in a millisecond */
+        }
     }
 
+    SDL_WaitThread(emulation, NULL);
+
     /* Cleanup */
+    dumpTrace();
+    if (traceFile) fclose(traceFile);
+    if (profile && chip8.profile) {
+        const size_t length = strlen(profile);
+        FILE *file = fopen(profile, "w");
+
+        if (file) {
+            if (length > 7 && !strcmp(profile + length - 7, ".folded")) profileFolded(&chip8, file);
+            else profileReport(&chip8, file);
+            fclose(file);
+        }
+        else {
+            printf("Could not write profile %s\n", profile);
+        }
+    }
+    free(quickState);
+    freeRewind(history);
+    stopInput(&chip8);
+    if (inputFile) fclose(inputFile);
+    SDL_DestroyAudioStream(audio); /* Stops the callback before the ring goes */
+    freeEmu(&chip8);
+    closePack(pack);
+    freeFrames(frames);
     cleanup(&sdl);
 
     /* Test */
@@ -0,0 +1,287 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Save states
+ *
+ * writeRam() marks the 256-byte page of every store in chip8->dirtyPages.
+ * saveState() into a state that is already in sync with the instance only
+ * copies the registers, VRAM and those pages, then clears the bitmap; the
+ * pages dirtied after that are exactly the ones loadState() has to put
+ * back. Out of sync states are copied in full.
+ *
+ * On disk: magic, version, registers and VRAM as little-endian fixed width
+ * fields, then a bitmap of non-zero RAM pages followed by those pages.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+#define pageWords (ramPages / 32)
+#define pageBit(page) (1u << ((page) & 31))
+
+static void getRegs(const chip8 *chip8, emuRegs *regs) {
+    memcpy(regs->stack, chip8->stack, sizeof regs->stack);
+    memcpy(regs->V, chip8->V, sizeof regs->V);
+    regs->I = chip8->I;
+    regs->PC = chip8->PC;
+    regs->SP = chip8->SP;
+    regs->delayTimer = chip8->delayTimer;
+    regs->soundTimer = chip8->soundTimer;
+    regs->pitch = chip8->pitch;
+    regs->bitMask = chip8->bitMask;
+    regs->hires = chip8->hires;
+    memcpy(regs->keypad, chip8->keypad, sizeof regs->keypad);
+    memcpy(regs->quirks, chip8->quirks, sizeof regs->quirks);
+    regs->beep = chip8->beep;
+    regs->exit = chip8->exit;
+    regs->cpuCycles = chip8->cpuCycles;
+    regs->soundCycles = chip8->soundCycles;
+    regs->delayCycles = chip8->delayCycles;
+    regs->refreshCycles = chip8->refreshCycles;
+    regs->instrCount = chip8->instrCount;
+    regs->rng = chip8->rng;
+}
+
+static void setRegs(chip8 *chip8, const emuRegs *regs) {
+    memcpy(chip8->stack, regs->stack, sizeof chip8->stack);
+    memcpy(chip8->V, regs->V, sizeof chip8->V);
+    chip8->I = regs->I;
+    chip8->PC = regs->PC;
+    chip8->SP = regs->SP;
+    chip8->delayTimer = regs->delayTimer;
+    chip8->soundTimer = regs->soundTimer;
+    chip8->pitch = regs->pitch;
+    chip8->bitMask = regs->bitMask;
+    chip8->hires = regs->hires;
+    memcpy(chip8->keypad, regs->keypad, sizeof chip8->keypad);
+    memcpy(chip8->quirks, regs->quirks, sizeof chip8->quirks);
+    chip8->beep = regs->beep;
+    chip8->exit = regs->exit;
+    chip8->cpuCycles = regs->cpuCycles;
+    chip8->soundCycles = regs->soundCycles;
+    chip8->delayCycles = regs->delayCycles;
+    chip8->refreshCycles = regs->refreshCycles;
+    chip8->instrCount = regs->instrCount;
+    chip8->rng = regs->rng;
+    resyncTimers(chip8);
+}
+
+static bool inSync(const chip8 *chip8, const emuState *state) {
+    return state->owner == chip8 && state->serial == chip8->stateSerial;
+}
+
+/* Snapshot chip8 into state. Returns the number of RAM pages copied. */
+unsigned long saveState(chip8 *chip8, emuState *state) {
+    const bool delta = inSync(chip8, state);
+    unsigned long copied = 0;
+    int page;
+
+    getRegs(chip8, &state->regs);
+    memcpy(state->vram, chip8->vram, sizeof state->vram);
+    memcpy(state->vram2, chip8->vram2, sizeof state->vram2);
+
+    for (page = 0; page < ramPages; page++) {
+        if (!delta || (chip8->dirtyPages[page >> 5] & pageBit(page))) {
+            memcpy(&state->ram[page * ramPageSize], ramPage(chip8, page), ramPageSize);
+            copied++;
+        }
+    }
+
+    if (delta) {
+        memcpy(state->pages, chip8->dirtyPages, sizeof state->pages);
+    }
+    else {
+        memset(state->pages, 0xFF, sizeof state->pages);
+    }
+
+    /* From here on the dirty bitmap tracks divergence from this state */
+    memset(chip8->dirtyPages, 0, sizeof chip8->dirtyPages);
+    state->owner = chip8;
+    state->serial = ++chip8->stateSerial;
+
+    return copied;
+}
+
+/* Full snapshot that leaves dirty tracking alone, for one-off saves that
+ * shouldn't break the delta chain of another state (e.g. rewind) */
+void copyState(const chip8 *chip8, emuState *state) {
+    int page;
+
+    getRegs(chip8, &state->regs);
+    memcpy(state->vram, chip8->vram, sizeof state->vram);
+    memcpy(state->vram2, chip8->vram2, sizeof state->vram2);
+    for (page = 0; page < ramPages; page++) {
+        memcpy(&state->ram[page * ramPageSize], ramPage(chip8, page), ramPageSize);
+    }
+    memset(state->pages, 0xFF, sizeof state->pages);
+    state->owner = NULL;
+    state->serial = 0;
+}
+
+/* Restore chip8 from state. Returns the number of RAM pages copied. */
+unsigned long loadState(chip8 *chip8, emuState *state) {
+    const bool delta = inSync(chip8, state);
+    const bool requirk = memcmp(chip8->quirks, state->regs.quirks, sizeof chip8->quirks) != 0;
+    unsigned long copied = 0;
+    int page;
+
+    setRegs(chip8, &state->regs);
+    if (requirk) applyQuirks(chip8);
+    memcpy(chip8->vram, state->vram, sizeof chip8->vram);
+    memcpy(chip8->vram2, state->vram2, sizeof chip8->vram2);
+    vramChanged(chip8, 0, screenHeight(chip8) - 1);
+
+    for (page = 0; page < ramPages; page++) {
+        if (!delta || (chip8->dirtyPages[page >> 5] & pageBit(page))) {
+            const uint8_t *from = &state->ram[page * ramPageSize];
+
+            /* Identical pages stay shared (and their decoded code stays valid) */
+            if (memcmp(ramPage(chip8, page), from, ramPageSize)) {
+                uint8_t *to = writablePage(chip8, page);
+                if (to) memcpy(to, from, ramPageSize);
+                ramChanged(chip8, page * ramPageSize, ramPageSize);
+            }
+            copied++;
+        }
+    }
+
+    /* ramChanged() dirtied what we restored, but it now matches the state */
+    memset(chip8->dirtyPages, 0, sizeof chip8->dirtyPages);
+    state->owner = chip8;
+    state->serial = ++chip8->stateSerial;
+
+    return copied;
+}
+
+/* Little-endian serialization helpers */
+static bool put(FILE *file, uint64_t value, int bytes) {
+    uint8_t buffer[8];
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        buffer[i] = (value >> (i * 8)) & 0xFF;
+    }
+    return fwrite(buffer, bytes, 1, file) == 1;
+}
+
+static bool get(FILE *file, uint64_t *value, int bytes) {
+    uint8_t buffer[8];
+    int i;
+
+    if (fread(buffer, bytes, 1, file) != 1) return false;
+
+    *value = 0;
+    for (i = 0; i < bytes; i++) {
+        *value |= (uint64_t)buffer[i] << (i * 8);
+    }
+    return true;
+}
+
+/* Every field of emuRegs, in file order */
+#define stateFields(field, array) \
+    array(stack, 2, 12) \
+    array(V, 1, 16) \
+    field(I, 2) \
+    field(PC, 2) \
+    field(SP, 2) \
+    field(delayTimer, 1) \
+    field(soundTimer, 1) \
+    field(pitch, 1) \
+    field(bitMask, 1) \
+    field(hires, 1) \
+    array(keypad, 1, defaultKeys) \
+    array(quirks, 1, defaultQuirks) \
+    field(beep, 1) \
+    field(exit, 1) \
+    field(cpuCycles, 4) \
+    field(soundCycles, 4) \
+    field(delayCycles, 4) \
+    field(refreshCycles, 4) \
+    field(instrCount, 8) \
+    field(rng, 4)
+
+bool writeState(const emuState *state, FILE *file) {
+    const emuRegs *regs = &state->regs;
+    uint32_t used[pageWords];
+    bool ok = true;
+    int i, page;
+
+    ok = ok && fwrite(stateMagic, 4, 1, file) == 1;
+    ok = ok && put(file, stateVersion, 2);
+
+#define writeField(name, bytes) ok = ok && put(file, (uint64_t)regs->name, bytes);
+#define writeArray(name, bytes, count) for (i = 0; i < (count); i++) ok = ok && put(file, (uint64_t)regs->name[i], bytes);
+    stateFields(writeField, writeArray)
+#undef writeField
+#undef writeArray
+
+    for (i = 0; i < hiresHeight * vramWords; i++) {
+        ok = ok && put(file, state->vram[i / vramWords][i % vramWords], 8);
+        ok = ok && put(file, state->vram2[i / vramWords][i % vramWords], 8);
+    }
+
+    /* Only pages with something in them */
+    memset(used, 0, sizeof used);
+    for (page = 0; page < ramPages; page++) {
+        const uint8_t *data = &state->ram[page * ramPageSize];
+        for (i = 0; i < ramPageSize; i++) {
+            if (data[i]) {
+                used[page >> 5] |= pageBit(page);
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < pageWords; i++) {
+        ok = ok && put(file, used[i], 4);
+    }
+    for (page = 0; page < ramPages; page++) {
+        if (used[page >> 5] & pageBit(page)) {
+            ok = ok && fwrite(&state->ram[page * ramPageSize], ramPageSize, 1, file) == 1;
+        }
+    }
+
+    return ok;
+}
+
+bool readState(emuState *state, FILE *file) {
+    emuRegs *regs = &state->regs;
+    uint32_t used[pageWords];
+    uint64_t value = 0;
+    char magic[4];
+    bool ok = true;
+    int i, page;
+
+    if (fread(magic, 4, 1, file) != 1 || memcmp(magic, stateMagic, 4)) return false;
+    if (!get(file, &value, 2) || value != stateVersion) return false;
+
+#define readField(name, bytes) ok = ok && get(file, &value, bytes); regs->name = value;
+#define readArray(name, bytes, count) for (i = 0; i < (count); i++) { ok = ok && get(file, &value, bytes); regs->name[i] = value; }
+    stateFields(readField, readArray)
+#undef readField
+#undef readArray
+
+    for (i = 0; i < hiresHeight * vramWords; i++) {
+        ok = ok && get(file, &state->vram[i / vramWords][i % vramWords], 8);
+        ok = ok && get(file, &state->vram2[i / vramWords][i % vramWords], 8);
+    }
+
+    for (i = 0; i < pageWords; i++) {
+        ok = ok && get(file, &value, 4);
+        used[i] = value;
+    }
+
+    memset(state->ram, 0, sizeof state->ram);
+    for (page = 0; page < ramPages; page++) {
+        if (used[page >> 5] & pageBit(page)) {
+            ok = ok && fread(&state->ram[page * ramPageSize], ramPageSize, 1, file) == 1;
+        }
+    }
+
+    /* Not in sync with any instance - the first load copies everything */
+    memset(state->pages, 0xFF, sizeof state->pages);
+    state->owner = NULL;
+    state->serial = 0;
+
+    return ok;
+}
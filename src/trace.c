@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Binary instruction trace
+ *
+ * The emulation thread is the only writer: it fills the slot at head and
+ * then publishes head. Readers (traceDump(), possibly from another thread
+ * or a crash handler) take a snapshot without locking and throw away any
+ * record the writer may have lapped while they were copying.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+struct emuTrace {
+    emuTraceRecord *records;
+    unsigned long mask; /* Size - 1, size is a power of two */
+    unsigned long head; /* Records written so far */
+};
+
+/* Enable tracing with a ring of at least records entries */
+bool initTrace(chip8 *chip8, unsigned long records) {
+    emuTrace *trace;
+    unsigned long size = 1;
+
+    while (size < records) size <<= 1;
+
+    freeTrace(chip8);
+
+    trace = malloc(sizeof *trace);
+    if (!trace) return 0; /* false */
+
+    trace->records = calloc(size, sizeof *trace->records);
+    if (!trace->records) {
+        free(trace);
+        return 0; /* false */
+    }
+
+    trace->mask = size - 1;
+    trace->head = 0;
+    chip8->trace = trace;
+    return 1; /* true */
+}
+
+void freeTrace(chip8 *chip8) {
+    if (chip8->trace) {
+        free(chip8->trace->records);
+        free(chip8->trace);
+        chip8->trace = NULL;
+    }
+}
+
+/* Append the state after the instruction at addr */
+void traceRecord(chip8 *chip8, uint16_t addr, uint16_t opcode) {
+    emuTrace *trace = chip8->trace;
+    const unsigned long head = trace->head;
+    emuTraceRecord *record = &trace->records[head & trace->mask];
+
+    record->cycle = (uint32_t)chip8->instrCount;
+    record->PC = addr;
+    record->opcode = opcode;
+    record->I = chip8->I;
+    record->SP = chip8->SP;
+    memcpy(record->V, chip8->V, sizeof record->V);
+    record->delayTimer = chip8->delayTimer;
+    record->soundTimer = chip8->soundTimer;
+
+    /* Record contents must be visible before the new head */
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Write the last count records (0 = everything in the ring) to file.
+ * Returns the number of records written. */
+unsigned long traceDump(const chip8 *chip8, FILE *file, unsigned long count) {
+    const emuTrace *trace = chip8->trace;
+    emuTraceHeader header;
+    emuTraceRecord *copy;
+    unsigned long head, first, last, i;
+
+    if (!trace) return 0;
+
+    head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    if (!count || count > trace->mask + 1) count = trace->mask + 1;
+    if (count > head) count = head;
+    first = head - count;
+
+    copy = malloc((count ? count : 1) * sizeof *copy);
+    if (!copy) return 0;
+
+    for (i = 0; i < count; i++) {
+        copy[i] = trace->records[(first + i) & trace->mask];
+    }
+
+    /* The writer may have reused (or be writing) the slots of the oldest
+     * records while we copied - those may be torn */
+    last = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    if (last - first > trace->mask) {
+        const unsigned long lapped = last - first - trace->mask;
+        const unsigned long drop = lapped < count ? lapped : count;
+        memmove(copy, copy + drop, (count - drop) * sizeof *copy);
+        count -= drop;
+    }
+
+    memcpy(header.magic, traceMagic, sizeof header.magic);
+    header.version = traceVersion;
+    header.recordSize = sizeof(emuTraceRecord);
+    header.count = count;
+
+    if (fwrite(&header, sizeof header, 1, file) != 1 ||
+        (count && fwrite(copy, sizeof *copy, count, file) != count)) {
+        count = 0;
+    }
+
+    fflush(file);
+    free(copy);
+    return count;
+}
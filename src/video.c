@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Framebuffer conversion and handoff - shared by every front end, no SDL here */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+/* FNV-1a over both packed VRAM planes, visible rows and words only - cheap
+ * fingerprint of a frame */
+uint64_t hashVram(const chip8 *chip8) {
+    const int height = screenHeight(chip8), words = chip8->hires ? vramWords : 1;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    int y, w, b;
+
+    for (y = 0; y < height; y++) {
+        for (w = 0; w < words; w++) {
+            const uint64_t rows[2] = {chip8->vram[y][w], chip8->vram2[y][w]};
+            int p;
+
+            for (p = 0; p < 2; p++) {
+                for (b = 0; b < 64; b += 8) {
+                    hash ^= (rows[p] >> b) & 0xFF;
+                    hash *= 0x100000001B3ULL;
+                }
+            }
+        }
+    }
+
+    return hash;
+}
+
+/* Both planes at once, height rows from the top of vram and vram2: plane
+ * bits pick palette[0] (neither), [1] (first), [2] (second) or [3] (both) */
+static void expandPlanes(const uint64_t (*vram)[vramWords], const uint64_t (*vram2)[vramWords], int width, int height,
+                         uint8_t *dst, int pitch, const uint32_t palette[4]) {
+    int x, y;
+
+    for (y = 0; y < height; y++, dst += pitch) {
+        const uint64_t *row = vram[y], *row2 = vram2[y];
+        uint32_t *out = (uint32_t *)dst;
+
+        for (x = 0; x < width; x++) {
+            out[x] = palette[vramPixel(row, x) | (vramPixel(row2, x) << 1)];
+        }
+    }
+}
+
+/* Expand packed VRAM into screenWidth() x screenHeight() RGBA8888 pixels,
+ * see expandPlanes() for the colors. pitch is the length of a destination
+ * row in bytes. */
+void expandVram(const chip8 *chip8, void *pixels, int pitch, const uint32_t palette[4]) {
+    expandPlanes((const uint64_t (*)[vramWords])chip8->vram, (const uint64_t (*)[vramWords])chip8->vram2,
+                 screenWidth(chip8), screenHeight(chip8), pixels, pitch, palette);
+}
+
+/* Same for rows top to bottom of a frame taken from latestFrame(), pixels
+ * being where row top goes */
+void expandFrame(const emuFrame *frame, int top, int bottom, void *pixels, int pitch, const uint32_t palette[4]) {
+    expandPlanes((const uint64_t (*)[vramWords])frame->vram + top, (const uint64_t (*)[vramWords])frame->vram2 + top,
+                 screenWidth(frame), bottom - top + 1, pixels, pitch, palette);
+}
+
+/* Note that rows top to bottom of the screen changed - draws, clears,
+ * scrolls and mode switches call this, so should hosts writing VRAM */
+void vramChanged(chip8 *chip8, int top, int bottom) {
+    if (!chip8->vramDirty || top < chip8->dirtyTop) chip8->dirtyTop = top;
+    if (!chip8->vramDirty || bottom > chip8->dirtyBottom) chip8->dirtyBottom = bottom;
+    chip8->vramDirty = true;
+}
+
+/* The rows changed since the last call, false if the screen is as it was */
+bool takeDirty(chip8 *chip8, int *top, int *bottom) {
+    if (!chip8->vramDirty) return 0; /* false */
+
+    *top = chip8->dirtyTop;
+    *bottom = chip8->dirtyBottom;
+    chip8->vramDirty = false;
+    return 1; /* true */
+}
+
+/* Lock-free triple buffer: the emulation thread fills back and swaps it
+ * with middle, a renderer swaps front with middle when it holds something
+ * newer. Neither side ever waits, and the renderer always gets the most
+ * recent complete frame. */
+#define frameFresh 4 /* Set in middle when it holds an unseen frame */
+
+struct emuFrames {
+    emuFrame slots[3];
+    int back; /* Emulation thread only */
+    int front; /* Renderer only */
+    int middle; /* Slot index | frameFresh, only ever exchanged atomically */
+
+    /* Emulation thread: changes the renderer may not have seen yet */
+    bool dirty; /* VRAM rows dirtyTop to dirtyBottom */
+    int dirtyTop;
+    int dirtyBottom;
+    bool changed; /* Mode or LCD setting */
+    bool hires; /* As last published */
+    bool fakeLcd;
+};
+
+emuFrames *createFrames(void) {
+    emuFrames *frames = calloc(1, sizeof *frames);
+
+    if (!frames) return NULL;
+
+    frames->back = 0;
+    frames->middle = 1;
+    frames->front = 2;
+    return frames;
+}
+
+void freeFrames(emuFrames *frames) {
+    free(frames);
+}
+
+/* Hand chip8's screen over - emulation thread, after each frame. Returns
+ * false, publishing nothing, while the screen stays as the renderer last
+ * took it. A frame's dirty rows cover every VRAM change since that one,
+ * so frames the renderer skipped don't lose theirs; a frame that only
+ * changes hires or fakeLcd has none. */
+bool publishFrame(emuFrames *frames, chip8 *chip8) {
+    emuFrame *frame = &frames->slots[frames->back];
+    int top, bottom;
+
+    /* Once the last frame is taken the renderer has every change up to it */
+    if (!(__atomic_load_n(&frames->middle, __ATOMIC_ACQUIRE) & frameFresh)) {
+        frames->dirty = false;
+        frames->changed = false;
+    }
+
+    if (chip8->hires != frames->hires || chip8->fakeLcd != frames->fakeLcd) {
+        frames->hires = chip8->hires;
+        frames->fakeLcd = chip8->fakeLcd;
+        frames->changed = true;
+    }
+
+    if (takeDirty(chip8, &top, &bottom)) {
+        if (!frames->dirty || top < frames->dirtyTop) frames->dirtyTop = top;
+        if (!frames->dirty || bottom > frames->dirtyBottom) frames->dirtyBottom = bottom;
+        frames->dirty = true;
+    }
+
+    if (!frames->dirty && !frames->changed) return 0; /* false */
+
+    memcpy(frame->vram, chip8->vram, sizeof frame->vram);
+    memcpy(frame->vram2, chip8->vram2, sizeof frame->vram2);
+    frame->hires = chip8->hires;
+    frame->fakeLcd = chip8->fakeLcd;
+    frame->dirtyTop = frames->dirty ? frames->dirtyTop : 0;
+    frame->dirtyBottom = frames->dirty ? frames->dirtyBottom : -1;
+
+    /* Frame contents must be visible before the slot is */
+    frames->back = __atomic_exchange_n(&frames->middle, frames->back | frameFresh, __ATOMIC_ACQ_REL) & 3;
+    return 1; /* true */
+}
+
+/* The newest published frame, or NULL if there is none since the last
+ * call - renderer thread. Valid until the next call. */
+const emuFrame *latestFrame(emuFrames *frames) {
+    if (!(__atomic_load_n(&frames->middle, __ATOMIC_ACQUIRE) & frameFresh)) return NULL;
+
+    frames->front = __atomic_exchange_n(&frames->middle, frames->front, __ATOMIC_ACQ_REL) & 3;
+    return &frames->slots[frames->front];
+}
@@ -0,0 +1,304 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Interpreter benchmarks
+ *
+ * Micro: execute() per opcode class and engine, draw() at several sprite
+ * heights and positions, updateTimers(), and the VRAM to RGBA expansion
+ * updateScr() uploads (run offscreen, no SDL). Macro: every ROM given on
+ * the command line, headless, for a fixed instruction count with idle
+ * loop skipping off, so every engine runs every instruction.
+ *
+ * Every benchmark is repeated and printed as one JSON object per line:
+ *     {"bench": ..., "engine": ..., "unit": ..., "mean": ..., "stddev": ..., "min": ..., "runs": ...}
+ *
+ * Usage: bench [-r runs] [-n instructions] [rom...]
+ */
+
+#define _POSIX_C_SOURCE 200112L /* clock_gettime */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/chip8.h"
+
+#define maxRuns 64
+
+static int runs = 7;
+static unsigned long romInstructions = 2000000;
+
+static const char *const engineNames[] = {"cached", "switch", "jit"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *bench, const char *engine, const char *unit, const double *samples) {
+    double mean = 0, variance = 0, min = samples[0];
+    int i;
+
+    for (i = 0; i < runs; i++) {
+        mean += samples[i];
+        if (samples[i] < min) min = samples[i];
+    }
+    mean /= runs;
+
+    for (i = 0; i < runs; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean);
+    }
+    variance /= runs > 1 ? runs - 1 : 1;
+
+    printf("{\"bench\": \"%s\", \"engine\": \"%s\", \"unit\": \"%s\", \"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, \"runs\": %d}\n",
+           bench, engine, unit, mean, sqrt(variance), min, runs);
+    fflush(stdout);
+}
+
+/* Opcode class loops: prologue once, body repeated, then jump back to the body */
+typedef struct {
+    const char *name;
+    uint16_t prologue[4];
+    uint16_t body[2];
+} opClass;
+
+static const opClass opClasses[] = {
+    {"execute/load-imm 6xNN", {0}, {0x6A12}},
+    {"execute/add-imm 7xNN", {0}, {0x7A01}},
+    {"execute/alu 8xy4", {0}, {0x8AB4}},
+    {"execute/shift 8xy6", {0}, {0x8AB6}},
+    {"execute/skip 3xNN", {0}, {0x3A01}},
+    {"execute/index ANNN+Fx1E", {0}, {0xA300, 0xFA1E}},
+    {"execute/bcd Fx33", {0xA300}, {0xFA33}},
+    {"execute/store Fx55", {0xA300}, {0xFF55}},
+    {"execute/load Fx65", {0xA300}, {0xFF65}},
+    {"execute/timer Fx15+Fx07", {0}, {0xFA15, 0xFB07}},
+    {"execute/random CxNN", {0}, {0xCAFF}},
+    {"execute/draw DxyN", {0xA000, 0x6A08, 0x6B04}, {0xDAB5}},
+};
+
+#define bodyRepeat 64
+
+/* Assemble prologue + body x bodyRepeat + JP body at 0x200 */
+static void assemble(chip8 *chip8, const opClass *op) {
+    uint16_t addr = pcStartDefault, loop;
+    int i, j;
+
+    for (i = 0; i < 4 && op->prologue[i]; i++, addr += 2) {
+        writeRam(chip8, addr, op->prologue[i] >> 8);
+        writeRam(chip8, addr + 1, op->prologue[i] & 0xFF);
+    }
+
+    loop = addr;
+    for (i = 0; i < bodyRepeat; i++) {
+        for (j = 0; j < 2 && op->body[j]; j++, addr += 2) {
+            writeRam(chip8, addr, op->body[j] >> 8);
+            writeRam(chip8, addr + 1, op->body[j] & 0xFF);
+        }
+    }
+
+    writeRam(chip8, addr, 0x10 | (loop >> 8));
+    writeRam(chip8, addr + 1, loop & 0xFF);
+}
+
+static void benchExecute(chip8 *chip8) {
+    const unsigned long count = 1000000;
+    double samples[maxRuns];
+    int e, c, r;
+
+    for (e = engineCached; e <= engineJit; e++) {
+        for (c = 0; c < (int)(sizeof opClasses / sizeof *opClasses); c++) {
+            for (r = 0; r < runs; r++) {
+                double start;
+
+                memset(chip8, 0, sizeof *chip8);
+                chip8->engine = e;
+                chip8->seed = 1;
+                if (!initEmu(chip8, NULL)) exit(EXIT_FAILURE);
+                assemble(chip8, &opClasses[c]);
+
+                start = now();
+                runInstructions(chip8, count);
+                samples[r] = (now() - start) * 1e9 / count;
+                freeEmu(chip8);
+            }
+            report(opClasses[c].name, engineNames[e], "ns/instruction", samples);
+        }
+    }
+}
+
+static void benchDraw(chip8 *chip8) {
+    static const struct {
+        const char *name;
+        uint8_t x, y, N;
+    } cases[] = {
+        {"draw/1 row aligned", 0, 0, 1},
+        {"draw/5 rows aligned", 8, 8, 5},
+        {"draw/5 rows unaligned", 3, 8, 5},
+        {"draw/15 rows unaligned", 27, 10, 15},
+        {"draw/15 rows clipped right", 60, 10, 15},
+        {"draw/15 rows clipped bottom", 20, 28, 15},
+    };
+    const unsigned long count = 2000000;
+    double samples[maxRuns];
+    int c, r;
+
+    memset(chip8, 0, sizeof *chip8);
+    if (!initEmu(chip8, NULL)) exit(EXIT_FAILURE);
+    chip8->I = 0x200;
+    {
+        uint8_t sprite[16];
+        memset(sprite, 0xA5, sizeof sprite);
+        storeRam(chip8, 0x200, sprite, sizeof sprite);
+    }
+
+    for (c = 0; c < (int)(sizeof cases / sizeof *cases); c++) {
+        for (r = 0; r < runs; r++) {
+            const double start = now();
+            unsigned long i;
+
+            for (i = 0; i < count; i++) {
+                draw(chip8, cases[c].x, cases[c].y, cases[c].N);
+            }
+            samples[r] = (now() - start) * 1e9 / count;
+        }
+        report(cases[c].name, "-", "ns/call", samples);
+    }
+
+    freeEmu(chip8);
+}
+
+static void benchTimers(chip8 *chip8) {
+    const unsigned long count = 10000000;
+    double samples[maxRuns];
+    int r;
+
+    memset(chip8, 0, sizeof *chip8);
+    chip8->timerHz = defaultTimerHz;
+    if (!initEmu(chip8, NULL)) exit(EXIT_FAILURE);
+    chip8->cycleTime = earthSecond / defaultSpeed;
+
+    for (r = 0; r < runs; r++) {
+        const double start = now();
+        unsigned long i;
+
+        /* Worst case for lazy timers: caught up after every instruction */
+        for (i = 0; i < count; i++) {
+            if (!chip8->delayTimer) chip8->delayTimer = 0xFF;
+            if (!chip8->soundTimer) chip8->soundTimer = 0xFF;
+            chip8->instrCount++;
+            updateTimers(chip8);
+        }
+        samples[r] = (now() - start) * 1e9 / count;
+    }
+    report("updateTimers", "-", "ns/call", samples);
+
+    freeEmu(chip8);
+}
+
+static void benchScreen(chip8 *chip8) {
+    static uint32_t pixels[hiresWidth * hiresHeight];
+    const uint32_t palette[4] = {defaultBgColor, defaultFgColor, defaultPlane2Color, defaultBlendColor};
+    const unsigned long count = 200000;
+    double samples[maxRuns];
+    int r, y;
+
+    /* Hi-res with both planes lit - the most the renderer ever does */
+    memset(chip8, 0, sizeof *chip8);
+    chip8->hires = true;
+    for (y = 0; y < hiresHeight; y++) {
+        chip8->vram[y][0] = chip8->vram[y][1] = 0xA5A5A5A5A5A5A5A5ULL >> (y & 7);
+        chip8->vram2[y][0] = chip8->vram2[y][1] = 0x3C3C3C3C3C3C3C3CULL >> (y & 7);
+    }
+
+    for (r = 0; r < runs; r++) {
+        const double start = now();
+        unsigned long i;
+
+        for (i = 0; i < count; i++) {
+            expandVram(chip8, pixels, hiresWidth * sizeof *pixels, palette);
+        }
+        samples[r] = count / (now() - start);
+    }
+    report("updateScr/expand offscreen", "-", "frames/sec", samples);
+}
+
+/* False, reporting nothing, if rom doesn't load */
+static bool benchRom(chip8 *chip8, const char *rom) {
+    double nsSamples[maxRuns], fpsSamples[maxRuns];
+    char name[4200];
+    int e, r;
+
+    sprintf(name, "rom/%.4096s", rom);
+
+    for (e = engineCached; e <= engineJit; e++) {
+        for (r = 0; r < runs; r++) {
+            unsigned long executed = 0, frames = 0;
+            double start, seconds;
+
+            memset(chip8, 0, sizeof *chip8);
+            chip8->engine = e;
+            chip8->seed = 1;
+            chip8->cpuHz = defaultSpeed;
+            chip8->timerHz = defaultTimerHz;
+            chip8->refreshHz = defaultRefreshHz;
+            chip8->noIdleSkip = true;
+            if (!initEmu(chip8, rom)) {
+                fprintf(stderr, "Skipping %s, could not load it\n", rom);
+                freeEmu(chip8);
+                return 0; /* false */
+            }
+
+            start = now();
+            while (executed < romInstructions && !chip8->exit) {
+                executed += runFrame(chip8);
+                frames++;
+            }
+            seconds = now() - start;
+
+            nsSamples[r] = executed ? seconds * 1e9 / executed : 0;
+            fpsSamples[r] = seconds > 0 ? frames / seconds : 0;
+            freeEmu(chip8);
+        }
+        report(name, engineNames[e], "ns/instruction", nsSamples);
+        report(name, engineNames[e], "frames/sec", fpsSamples);
+    }
+
+    return 1; /* true */
+}
+
+int main(int argc, char **argv) {
+    chip8 *chip8 = calloc(1, sizeof *chip8);
+    bool failed = false;
+
+    if (!chip8) exit(EXIT_FAILURE);
+
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-r") && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+            if (runs < 1) runs = 1;
+            if (runs > maxRuns) runs = maxRuns;
+        }
+        else if (!strcmp(argv[arg], "-n") && arg + 1 < argc) {
+            romInstructions = strtoul(argv[++arg], NULL, 10);
+        }
+    }
+
+    benchExecute(chip8);
+    benchDraw(chip8);
+    benchTimers(chip8);
+    benchScreen(chip8);
+
+    for (arg = 1; arg < argc; arg++) {
+        if ((!strcmp(argv[arg], "-r") || !strcmp(argv[arg], "-n")) && arg + 1 < argc) {
+            arg++;
+            continue;
+        }
+        if (!benchRom(chip8, argv[arg])) failed = true;
+    }
+
+    free(chip8);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * ROM pack builder
+ *
+ * Packs every regular file in a directory into one ROM pack (see
+ * src/pack.c), sorted by name, with each ROM's SHA-1. The suggested quirk
+ * preset comes from the extension (.sc8 SUPER-CHIP, .xo8 XO-CHIP) unless
+ * -q picks one for every ROM; -s suggests a speed. Prints one tab
+ * separated line per ROM packed:
+ *
+ *     sha1  size  name
+ *
+ * Usage: mkpack [-q chip8|schip|xochip] [-s instructions/sec] pack directory
+ */
+
+#define _POSIX_C_SOURCE 200112L /* opendir, stat */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../include/chip8.h"
+
+#define headerSize 16
+#define entrySize 128
+
+static void put32(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = value >> 24;
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [-q chip8|schip|xochip] [-s instructions/sec] pack directory\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static int byName(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Preset suggested by a file name's extension */
+static EMUPLATFORM guessPlatform(const char *name) {
+    const char *dot = strrchr(name, '.');
+
+    if (dot && !strcmp(dot, ".sc8")) return platformSuperChip;
+    if (dot && !strcmp(dot, ".xo8")) return platformXoChip;
+    return platformCustom;
+}
+
+/* Names of the regular files in path that fit a pack entry, sorted */
+static unsigned long listRoms(const char *path, char ***names) {
+    DIR *dir = opendir(path);
+    struct dirent *file;
+    unsigned long count = 0;
+
+    if (!dir) {
+        printf("Could not open directory %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    while ((file = readdir(dir))) {
+        char full[4096];
+        struct stat info;
+        char *copy;
+
+        if (file->d_name[0] == '.') continue;
+
+        sprintf(full, "%.2000s/%.2000s", path, file->d_name);
+        if (stat(full, &info) || !S_ISREG(info.st_mode)) continue;
+
+        if (strlen(file->d_name) >= packNameSize) {
+            printf("Skipping %s, name longer than %d characters\n", file->d_name, packNameSize - 1);
+            continue;
+        }
+
+        copy = malloc(strlen(file->d_name) + 1);
+        *names = realloc(*names, (count + 1) * sizeof **names);
+        if (!copy || !*names) exit(EXIT_FAILURE);
+
+        strcpy(copy, file->d_name);
+        (*names)[count++] = copy;
+    }
+
+    closedir(dir);
+    qsort(*names, count, sizeof **names, byName);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    const char *packPath = NULL, *dirPath = NULL;
+    EMUPLATFORM platform = platformCustom;
+    bool guess = true;
+    unsigned long cpuHz = 0, count, packed = 0, offset, i;
+    static uint8_t rom[maxRam];
+    char **names = NULL;
+    uint8_t *index;
+    FILE *pack;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-s") && arg + 1 < argc) {
+            cpuHz = strtoul(argv[++arg], NULL, 10);
+        }
+        else if (!strcmp(argv[arg], "-q") && arg + 1 < argc) {
+            arg++;
+            guess = false;
+            if (!strcmp(argv[arg], "chip8")) platform = platformChip8;
+            else if (!strcmp(argv[arg], "schip")) platform = platformSuperChip;
+            else if (!strcmp(argv[arg], "xochip")) platform = platformXoChip;
+            else usage(argv[0]);
+        }
+        else if (!packPath) {
+            packPath = argv[arg];
+        }
+        else {
+            dirPath = argv[arg];
+        }
+    }
+
+    if (!packPath || !dirPath) usage(argv[0]);
+
+    count = listRoms(dirPath, &names);
+    index = calloc(count ? count : 1, entrySize);
+    pack = fopen(packPath, "wb");
+    if (!index || !pack) {
+        printf("Could not write ROM pack %s\n", packPath);
+        exit(EXIT_FAILURE);
+    }
+
+    /* ROMs first, on page boundaries after the index; the index is
+     * written last, once every hash and offset is known */
+    offset = (headerSize + count * entrySize + ramPageSize - 1) & ~(unsigned long)(ramPageSize - 1);
+
+    for (i = 0; i < count; i++) {
+        uint8_t *e = &index[packed * entrySize];
+        char full[4096];
+        unsigned long size, padded;
+        FILE *file;
+        int b;
+
+        sprintf(full, "%.2000s/%.2000s", dirPath, names[i]);
+        file = fopen(full, "rb");
+        if (!file) {
+            printf("Skipping %s, could not open it\n", names[i]);
+            continue;
+        }
+
+        /* One byte more than fits tells a too large ROM apart */
+        size = fread(rom, 1, maxRam - pcStartDefault + 1, file);
+        fclose(file);
+        if (size > maxRam - pcStartDefault) {
+            printf("Skipping %s, too large\n", names[i]);
+            continue;
+        }
+
+        padded = (size + ramPageSize - 1) & ~(unsigned long)(ramPageSize - 1);
+        memset(rom + size, 0, padded - size);
+
+        if (fseek(pack, offset, SEEK_SET) || fwrite(rom, 1, padded, pack) != padded) {
+            printf("Could not write ROM pack %s\n", packPath);
+            exit(EXIT_FAILURE);
+        }
+
+        strcpy((char *)e, names[i]);
+        sha1(rom, size, &e[packNameSize]);
+        put32(&e[108], offset);
+        put32(&e[112], size);
+        put32(&e[116], cpuHz);
+        e[120] = guess ? guessPlatform(names[i]) : platform;
+
+        for (b = 0; b < 20; b++) printf("%02x", e[packNameSize + b]);
+        printf("\t%lu\t%s\n", size, names[i]);
+
+        offset += padded;
+        packed++;
+    }
+
+    {
+        uint8_t header[headerSize] = {0};
+
+        memcpy(header, packMagic, 4);
+        header[4] = packVersion & 0xFF;
+        header[5] = packVersion >> 8;
+        put32(&header[8], packed);
+
+        rewind(pack);
+        if (fwrite(header, sizeof header, 1, pack) != 1 ||
+            (packed && fwrite(index, packed * entrySize, 1, pack) != 1) || fclose(pack)) {
+            printf("Could not write ROM pack %s\n", packPath);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < count; i++) free(names[i]);
+    free(names);
+    free(index);
+    exit(EXIT_SUCCESS);
+}
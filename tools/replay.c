@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Headless input log replay
+ *
+ * Replays an input log recorded with sunchip -i against a ROM as fast as
+ * the host allows and prints one tab separated line per frame:
+ *
+ *     frame  vram hash
+ *
+ * Two replays agree iff the emulation agreed, so diffing the output of
+ * different engines or builds checks they didn't change results.
+ *
+ * With -v every frame is also recorded as video, in the default colors at
+ * -x times 128x64: YUV4MPEG2 if the file name ends in .y4m, raw RGBA
+ * otherwise. Encoding runs on its own thread, see src/capture.c.
+ *
+ * With -c the log is also replayed on a second engine in lockstep, and
+ * replay fails at the first frame where the two disagree on VRAM,
+ * registers, timers or instruction count - make check runs the reference
+ * interpreter against the recompiler this way.
+ *
+ * Usage: replay [-e engine] [-c engine] [-f frames] [-a pack] [-v video [-x scale]] log rom
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+static void usage(const char *name) {
+    printf("Usage: %s [-e cached|switch|jit] [-c cached|switch|jit] [-f frames] [-a pack] [-v video [-x scale]] log rom\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/* An engine by name - anything else is a usage error */
+static EMUENGINE parseEngine(const char *name, const char *self) {
+    if (!strcmp(name, "switch")) return engineSwitch;
+    if (!strcmp(name, "jit")) return engineJit;
+    if (strcmp(name, "cached")) usage(self);
+    return engineCached;
+}
+
+/* Everything a ROM can observe, plus how far it got */
+static bool sameState(const chip8 *a, const chip8 *b) {
+    return a->PC == b->PC && a->I == b->I && a->SP == b->SP && !memcmp(a->V, b->V, sizeof a->V) &&
+           a->delayTimer == b->delayTimer && a->soundTimer == b->soundTimer &&
+           a->instrCount == b->instrCount && a->exit == b->exit && hashVram(a) == hashVram(b);
+}
+
+int main(int argc, char **argv) {
+    chip8 *chip8 = calloc(1, sizeof *chip8), *other = NULL;
+    const char *log = NULL, *rom = NULL, *video = NULL;
+    unsigned long frames = 0, frame; /* 0 = as many as the log has */
+    int scale = 1;
+    emuPack *pack = NULL;
+    emuCapture *capture = NULL;
+    FILE *file, *otherFile = NULL, *videoFile = NULL;
+
+    if (!chip8) exit(EXIT_FAILURE);
+    chip8->engine = engineCached;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-f") && arg + 1 < argc) {
+            frames = strtoul(argv[++arg], NULL, 10);
+        }
+        else if (!strcmp(argv[arg], "-e") && arg + 1 < argc) {
+            chip8->engine = parseEngine(argv[++arg], argv[0]);
+        }
+        else if (!strcmp(argv[arg], "-c") && arg + 1 < argc) {
+            other = calloc(1, sizeof *other);
+            if (!other) exit(EXIT_FAILURE);
+            other->engine = parseEngine(argv[++arg], argv[0]);
+        }
+        else if (!strcmp(argv[arg], "-a") && arg + 1 < argc) {
+            /* rom is a name or SHA-1 in this pack */
+            pack = openPack(argv[++arg]);
+            if (!pack) exit(EXIT_FAILURE);
+            chip8->pack = pack;
+        }
+        else if (!strcmp(argv[arg], "-v") && arg + 1 < argc) {
+            video = argv[++arg];
+        }
+        else if (!strcmp(argv[arg], "-x") && arg + 1 < argc) {
+            scale = atoi(argv[++arg]);
+        }
+        else if (!log) {
+            log = argv[arg];
+        }
+        else {
+            rom = argv[arg];
+        }
+    }
+
+    if (!log || !rom) {
+        usage(argv[0]);
+    }
+
+    file = fopen(log, "rb");
+    if (!file || !replayInput(chip8, file)) {
+        printf("Could not read input log %s\n", log);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!initEmu(chip8, rom)) exit(EXIT_FAILURE);
+
+    if (other) {
+        other->pack = pack;
+        otherFile = fopen(log, "rb");
+        if (!otherFile || !replayInput(other, otherFile)) {
+            printf("Could not read input log %s\n", log);
+            exit(EXIT_FAILURE);
+        }
+        if (!initEmu(other, rom)) exit(EXIT_FAILURE);
+    }
+
+    if (video) {
+        const uint32_t palette[4] = {defaultBgColor, defaultFgColor, defaultPlane2Color, defaultBlendColor};
+        const size_t length = strlen(video);
+        const bool y4m = length > 4 && !strcmp(video + length - 4, ".y4m");
+
+        videoFile = fopen(video, "wb");
+        if (videoFile) capture = startCapture(chip8, videoFile, y4m ? captureY4m : captureRgba, scale, palette);
+        if (!capture) {
+            printf("Could not record video to %s\n", video);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (frame = 0; !chip8->exit && (frames ? frame < frames : !inputDone(chip8)); frame++) {
+        runFrame(chip8);
+        printf("%lu\t%016llx\n", frame, (unsigned long long)hashVram(chip8));
+
+        if (other) {
+            runFrame(other);
+            if (!sameState(chip8, other)) {
+                fprintf(stderr, "Engines disagree at frame %lu: PC %03X/%03X, %llu/%llu instructions\n", frame,
+                        chip8->PC, other->PC, (unsigned long long)chip8->instrCount,
+                        (unsigned long long)other->instrCount);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (capture && !captureFrame(capture, chip8)) break;
+    }
+
+    if (capture) {
+        const bool ok = stopCapture(capture);
+
+        if (fclose(videoFile) || !ok) {
+            printf("Could not record video to %s\n", video);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (other) {
+        freeEmu(other);
+        fclose(otherFile);
+        free(other);
+    }
+
+    freeEmu(chip8);
+    closePack(pack);
+    fclose(file);
+    free(chip8);
+    exit(EXIT_SUCCESS);
+}
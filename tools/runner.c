@@ -0,0 +1,361 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Headless multi-ROM regression runner
+ *
+ * Runs every ROM on its own chip8 instance for a fixed number of frames or
+ * instructions, spread over a pool of threads, and prints one tab separated
+ * line per ROM in input order:
+ *
+ *     rom  frames  instructions  vram hash  instructions/sec
+ *
+ * Every distinct ROM is loaded once into a shared image; with make PAGED=1
+ * instances of the same ROM also share its pages until they write them.
+ *
+ * With -a, ROMs are names or SHA-1s in a ROM pack built by mkpack (every
+ * ROM in it if none are given) and each instance loads straight from the
+ * mapped pack, taking the pack's suggested preset and speed unless -q
+ * says otherwise.
+ *
+ * With -p (and a make PROFILE=1 build) each ROM is profiled and the
+ * reports are written to the given file in the same order.
+ *
+ * Usage: runner [-j threads] [-f frames | -n instructions] [-e engine]
+ *               [-q quirks] [-s seed] [-a pack] [-l list file] [-p profile file] [rom...]
+ */
+
+#define _POSIX_C_SOURCE 200112L /* sysconf, clock_gettime */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/chip8.h"
+
+typedef struct {
+    const char *rom;
+    const emuImage *image; /* Font + ROM, shared by jobs running the same file */
+    unsigned long frames;
+    unsigned long instructions;
+    uint64_t hash;
+    double seconds;
+    char *profile; /* profileReport() text, when profiling */
+    bool ok;
+} runJob;
+
+/* Each worker owns a slice of the job list and takes from the front of it;
+ * once its own slice is empty it steals from the other slices */
+typedef struct {
+    unsigned long next; /* Next job to take, bumped atomically */
+    unsigned long end;
+} runSlice;
+
+typedef struct {
+    runJob *jobs;
+    runSlice *slices;
+    int workers;
+    unsigned long frames; /* Run this many frames... */
+    unsigned long instructions; /* ...or this many instructions */
+    EMUENGINE engine;
+    EMUPLATFORM platform;
+    uint32_t seed;
+    bool profile;
+    const emuPack *pack; /* ROMs are looked up here, NULL = they are files */
+} runPool;
+
+typedef struct {
+    runPool *pool;
+    int id;
+} runWorker;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Claim a job from slice, or return -1 if it is drained */
+static long take(runSlice *slice) {
+    const unsigned long job = __atomic_fetch_add(&slice->next, 1, __ATOMIC_RELAXED);
+    return job < slice->end ? (long)job : -1;
+}
+
+static void runOne(const runPool *pool, runJob *job) {
+    chip8 *chip8 = calloc(1, sizeof *chip8);
+    double start;
+
+    if (!chip8) return;
+
+    chip8->engine = pool->engine;
+    chip8->platform = pool->platform;
+    chip8->seed = pool->seed;
+    chip8->cpuHz = defaultSpeed;
+    chip8->pack = pool->pack;
+    if (pool->pack) {
+        emuPackRom rom;
+        if (findPackRom(pool->pack, job->rom, &rom)) {
+            if (pool->platform == platformCustom) chip8->platform = rom.platform;
+            if (rom.cpuHz) chip8->cpuHz = rom.cpuHz;
+        }
+    }
+    chip8->timerHz = defaultTimerHz;
+    chip8->refreshHz = defaultRefreshHz;
+    chip8->image = job->image;
+    if (pool->profile) initProfile(chip8);
+
+    if (initEmu(chip8, job->rom)) {
+        start = now();
+        if (pool->instructions) {
+            job->instructions = runInstructions(chip8, pool->instructions);
+        }
+        else {
+            while (job->frames < pool->frames && !chip8->exit) {
+                job->instructions += runFrame(chip8);
+                job->frames++;
+            }
+        }
+        job->seconds = now() - start;
+        job->hash = hashVram(chip8);
+        job->ok = true;
+
+        if (chip8->profile) {
+            /* Kept in memory so reports come out in input order */
+            FILE *file = tmpfile();
+            if (file) {
+                long length;
+                profileReport(chip8, file);
+                length = ftell(file);
+                job->profile = malloc(length + 1);
+                rewind(file);
+                if (job->profile) job->profile[fread(job->profile, 1, length, file)] = '\0';
+                fclose(file);
+            }
+        }
+    }
+
+    freeEmu(chip8);
+    free(chip8);
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [-j threads] [-f frames | -n instructions] [-e cached|switch|jit] [-q chip8|schip|xochip] [-s seed] [-a pack] [-l list file] [-p profile file] [rom...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void *work(void *arg) {
+    const runWorker *worker = arg;
+    runPool *pool = worker->pool;
+    int victim;
+
+    for (victim = 0; victim < pool->workers; victim++) {
+        /* Own slice first, then walk the others */
+        runSlice *slice = &pool->slices[(worker->id + victim) % pool->workers];
+        long job;
+
+        while ((job = take(slice)) >= 0) {
+            /* A ROM that didn't load has already said so, it stays FAILED */
+            if (pool->pack || pool->jobs[job].image) runOne(pool, &pool->jobs[job]);
+        }
+    }
+
+    return NULL;
+}
+
+/* Load each distinct ROM once, jobs for the same file share the image.
+ * Jobs whose ROM failed to load are left without one and never run. */
+static void loadImages(runJob *jobs, unsigned long count) {
+    unsigned long i, j;
+
+    for (i = 0; i < count; i++) {
+        chip8 *chip8;
+
+        for (j = 0; j < i; j++) {
+            if (!strcmp(jobs[j].rom, jobs[i].rom)) break;
+        }
+        if (j < i) {
+            jobs[i].image = jobs[j].image;
+            continue;
+        }
+
+        chip8 = calloc(1, sizeof *chip8);
+        if (!chip8) exit(EXIT_FAILURE);
+        if (initEmu(chip8, jobs[i].rom)) {
+            jobs[i].image = createImage(chip8);
+        }
+        freeEmu(chip8);
+        free(chip8);
+    }
+}
+
+/* Append the ROM paths listed one per line in path */
+static unsigned long readList(const char *path, runJob **jobs, unsigned long count) {
+    FILE *file = fopen(path, "r");
+    char line[4096];
+
+    if (!file) {
+        printf("Could not open ROM list: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    while (fgets(line, sizeof line, file)) {
+        char *copy;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) continue;
+
+        copy = malloc(strlen(line) + 1);
+        *jobs = realloc(*jobs, (count + 1) * sizeof **jobs);
+        if (!copy || !*jobs) exit(EXIT_FAILURE);
+
+        strcpy(copy, line);
+        memset(&(*jobs)[count], 0, sizeof **jobs);
+        (*jobs)[count++].rom = copy;
+    }
+
+    fclose(file);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    runPool pool;
+    runJob *jobs = NULL;
+    runWorker *workers;
+    pthread_t *threads;
+    unsigned long count = 0, i;
+    bool failed = false;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *profile = NULL;
+    int w;
+
+    memset(&pool, 0, sizeof pool);
+    pool.workers = cpus > 0 ? (int)cpus : 1;
+    pool.frames = 600; /* 10 seconds of emulated time */
+    pool.engine = engineCached;
+    pool.seed = 1; /* Same seed every run so hashes are comparable */
+
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+            pool.workers = atoi(argv[++arg]);
+        }
+        else if (!strcmp(argv[arg], "-f") && arg + 1 < argc) {
+            pool.frames = strtoul(argv[++arg], NULL, 10);
+            pool.instructions = 0;
+        }
+        else if (!strcmp(argv[arg], "-n") && arg + 1 < argc) {
+            pool.instructions = strtoul(argv[++arg], NULL, 10);
+        }
+        else if (!strcmp(argv[arg], "-s") && arg + 1 < argc) {
+            pool.seed = strtoul(argv[++arg], NULL, 10);
+        }
+        else if (!strcmp(argv[arg], "-e") && arg + 1 < argc) {
+            arg++;
+            if (!strcmp(argv[arg], "switch")) pool.engine = engineSwitch;
+            else if (!strcmp(argv[arg], "jit")) pool.engine = engineJit;
+            else if (!strcmp(argv[arg], "cached")) pool.engine = engineCached;
+            else usage(argv[0]);
+        }
+        else if (!strcmp(argv[arg], "-q") && arg + 1 < argc) {
+            arg++;
+            if (!strcmp(argv[arg], "chip8")) pool.platform = platformChip8;
+            else if (!strcmp(argv[arg], "schip")) pool.platform = platformSuperChip;
+            else if (!strcmp(argv[arg], "xochip")) pool.platform = platformXoChip;
+            else usage(argv[0]);
+        }
+        else if (!strcmp(argv[arg], "-p") && arg + 1 < argc) {
+            profile = argv[++arg];
+            pool.profile = true;
+#ifndef SUNCHIP_PROFILE
+            puts("Profiling is not compiled in, rebuild with make PROFILE=1");
+#endif
+        }
+        else if (!strcmp(argv[arg], "-a") && arg + 1 < argc) {
+            pool.pack = openPack(argv[++arg]);
+            if (!pool.pack) exit(EXIT_FAILURE);
+        }
+        else if (!strcmp(argv[arg], "-l") && arg + 1 < argc) {
+            count = readList(argv[++arg], &jobs, count);
+        }
+        else if (argv[arg][0] == '-') {
+            usage(argv[0]);
+        }
+        else {
+            jobs = realloc(jobs, (count + 1) * sizeof *jobs);
+            if (!jobs) exit(EXIT_FAILURE);
+            memset(&jobs[count], 0, sizeof *jobs);
+            jobs[count++].rom = argv[arg];
+        }
+    }
+
+    if (!count && pool.pack) {
+        /* The whole pack */
+        count = packCount(pool.pack);
+        jobs = calloc(count ? count : 1, sizeof *jobs);
+        if (!jobs) exit(EXIT_FAILURE);
+        for (i = 0; i < count; i++) {
+            emuPackRom rom;
+            packRom(pool.pack, i, &rom);
+            jobs[i].rom = rom.name;
+        }
+    }
+
+    if (!count) usage(argv[0]);
+
+    if (pool.workers < 1) pool.workers = 1;
+    if ((unsigned long)pool.workers > count) pool.workers = count;
+
+    /* Pack ROMs need no image, instances read the mapping directly */
+    if (!pool.pack) loadImages(jobs, count);
+
+    /* Contiguous slices, one per worker */
+    pool.jobs = jobs;
+    pool.slices = malloc(pool.workers * sizeof *pool.slices);
+    workers = malloc(pool.workers * sizeof *workers);
+    threads = malloc(pool.workers * sizeof *threads);
+    if (!pool.slices || !workers || !threads) exit(EXIT_FAILURE);
+
+    for (w = 0; w < pool.workers; w++) {
+        pool.slices[w].next = count * w / pool.workers;
+        pool.slices[w].end = count * (w + 1) / pool.workers;
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+
+    for (w = 0; w < pool.workers; w++) {
+        if (pthread_create(&threads[w], NULL, work, &workers[w])) {
+            /* Whatever is left gets stolen by the threads we did start */
+            if (w == 0) work(&workers[0]);
+            break;
+        }
+    }
+    while (w-- > 0) {
+        pthread_join(threads[w], NULL);
+    }
+
+    for (i = 0; i < count; i++) {
+        const runJob *job = &jobs[i];
+
+        if (!job->ok) {
+            printf("%s\tFAILED\n", job->rom);
+            failed = true;
+            continue;
+        }
+        printf("%s\t%lu\t%lu\t%016llx\t%.0f\n", job->rom, job->frames, job->instructions,
+               (unsigned long long)job->hash, job->seconds > 0 ? job->instructions / job->seconds : 0.0);
+    }
+
+    if (profile) {
+        FILE *file = fopen(profile, "w");
+
+        if (!file) {
+            printf("Could not write profile %s\n", profile);
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < count; i++) {
+            if (jobs[i].profile) fprintf(file, "%s\n", jobs[i].profile);
+        }
+        fclose(file);
+    }
+
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: (Unlicense OR CC0-1.0 OR WTFPL OR MIT-0 OR 0BSD)
+ * Decode a SunChip binary trace dump
+ *
+ * Usage: tracedump [-n count] [trace file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+/* Write a mnemonic for opcode into out (at most 16 characters) */
+void disassemble(uint16_t opcode, char *out) {
+    const uint8_t x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF;
+    const uint8_t N = opcode & 0xF, NN = opcode & 0xFF;
+    const uint16_t NNN = opcode & 0xFFF;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x0000) sprintf(out, "HALT");
+            else if (opcode == 0x00E0) sprintf(out, "CLS");
+            else if (opcode == 0x00EE) sprintf(out, "RET");
+            else if ((opcode & 0xFFF0) == 0x00C0) sprintf(out, "SCD  %X", N);
+            else if ((opcode & 0xFFF0) == 0x00D0) sprintf(out, "SCU  %X", N);
+            else if (opcode == 0x00FB) sprintf(out, "SCR");
+            else if (opcode == 0x00FC) sprintf(out, "SCL");
+            else if (opcode == 0x00FD) sprintf(out, "EXIT");
+            else if (opcode == 0x00FE) sprintf(out, "LOW");
+            else if (opcode == 0x00FF) sprintf(out, "HIGH");
+            else sprintf(out, "SYS  %03X", NNN);
+            break;
+        case 0x1: sprintf(out, "JP   %03X", NNN); break;
+        case 0x2: sprintf(out, "CALL %03X", NNN); break;
+        case 0x3: sprintf(out, "SE   V%X, %02X", x, NN); break;
+        case 0x4: sprintf(out, "SNE  V%X, %02X", x, NN); break;
+        case 0x5: sprintf(out, "SE   V%X, V%X", x, y); break;
+        case 0x6: sprintf(out, "LD   V%X, %02X", x, NN); break;
+        case 0x7: sprintf(out, "ADD  V%X, %02X", x, NN); break;
+        case 0x8: {
+            static const char *const alu[16] = {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                "?", "?", "?", "?", "?", "?", "SHL", "?"
+            };
+            sprintf(out, "%-4s V%X, V%X", alu[N], x, y);
+            break;
+        }
+        case 0x9: sprintf(out, "SNE  V%X, V%X", x, y); break;
+        case 0xA: sprintf(out, "LD   I, %03X", NNN); break;
+        case 0xB: sprintf(out, "JP   V0, %03X", NNN); break;
+        case 0xC: sprintf(out, "RND  V%X, %02X", x, NN); break;
+        case 0xD: sprintf(out, "DRW  V%X, V%X, %X", x, y, N); break;
+        case 0xE:
+            if (NN == 0x9E) sprintf(out, "SKP  V%X", x);
+            else if (NN == 0xA1) sprintf(out, "SKNP V%X", x);
+            else sprintf(out, "?");
+            break;
+        case 0xF:
+            switch (NN) {
+                case 0x00: sprintf(out, x ? "?" : "LD   I, LONG"); break;
+                case 0x01: sprintf(out, "PLANE %X", x); break;
+                case 0x02: sprintf(out, x ? "?" : "AUDIO"); break;
+                case 0x07: sprintf(out, "LD   V%X, DT", x); break;
+                case 0x0A: sprintf(out, "LD   V%X, K", x); break;
+                case 0x15: sprintf(out, "LD   DT, V%X", x); break;
+                case 0x18: sprintf(out, "LD   ST, V%X", x); break;
+                case 0x1E: sprintf(out, "ADD  I, V%X", x); break;
+                case 0x29: sprintf(out, "LD   F, V%X", x); break;
+                case 0x30: sprintf(out, "LD   HF, V%X", x); break;
+                case 0x33: sprintf(out, "LD   B, V%X", x); break;
+                case 0x3A: sprintf(out, "PITCH V%X", x); break;
+                case 0x55: sprintf(out, "LD   [I], V%X", x); break;
+                case 0x65: sprintf(out, "LD   V%X, [I]", x); break;
+                default: sprintf(out, "?"); break;
+            }
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    unsigned long show = 0, i;
+    emuTraceHeader header;
+    emuTraceRecord record;
+    FILE *file;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-n") && arg + 1 < argc) {
+            show = strtoul(argv[++arg], NULL, 10);
+        }
+        else {
+            path = argv[arg];
+        }
+    }
+
+    if (!path) {
+        printf("Usage: %s [-n count] [trace file]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    file = fopen(path, "rb");
+    if (!file) {
+        printf("Could not open trace file: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(&header, sizeof header, 1, file) != 1 ||
+        memcmp(header.magic, traceMagic, sizeof header.magic) ||
+        header.version != traceVersion || header.recordSize != sizeof record) {
+        printf("Not a version %d trace file: %s\n", traceVersion, path);
+        fclose(file);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Only the newest records are interesting after a crash */
+    if (show && show < header.count) {
+        fseek(file, (long)((header.count - show) * sizeof record), SEEK_CUR);
+    }
+    else {
+        show = header.count;
+    }
+
+    for (i = 0; i < show && fread(&record, sizeof record, 1, file) == 1; i++) {
+        char text[32];
+        int r;
+
+        disassemble(record.opcode, text);
+        printf("%10lu %03X: %04X %-16s I=%03X SP=%02X DT=%02X ST=%02X V=",
+               (unsigned long)record.cycle, record.PC, record.opcode, text,
+               record.I, record.SP, record.delayTimer, record.soundTimer);
+        for (r = 0; r < 16; r++) {
+            printf("%02X%c", record.V[r], r == 15 ? '\n' : ' ');
+        }
+    }
+
+    fclose(file);
+    exit(EXIT_SUCCESS);
+}